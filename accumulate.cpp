@@ -0,0 +1,142 @@
+#include <cstdlib>
+
+#if defined(__x86_64__) || defined(__i386__)
+#include <immintrin.h>
+#define ACCUMULATE_X86
+#elif defined(__ARM_NEON) || defined(__ARM_NEON__)
+#include <arm_neon.h>
+#define ACCUMULATE_NEON
+#endif
+
+#include "accumulate.h"
+
+typedef void (*accumulate_func)(const uint16_t *, int32_t *, uint16_t *, int, int);
+
+static void accumulate_scalar(const uint16_t *pix, int32_t *sum, uint16_t *count, int n, int threshold) {
+	for(int i = 0; i < n; i++) {
+		int32_t p = pix[i];
+		int32_t c = count[i];
+		int32_t diff = abs(sum[i]-p*c);
+		
+		// all-ones if the sample is accepted
+		int32_t accept = -((p != 0) & ((c == 0) | (diff < threshold*c)));
+		
+		sum[i] += p & accept;
+		count[i] -= accept;
+	}
+}
+
+#ifdef ACCUMULATE_X86
+__attribute__((target("avx2")))
+static void accumulate_avx2(const uint16_t *pix, int32_t *sum, uint16_t *count, int n, int threshold) {
+	const __m256i zero = _mm256_setzero_si256();
+	const __m256i thr = _mm256_set1_epi32(threshold);
+	int i = 0;
+	
+	for(; i+8 <= n; i += 8) {
+		__m256i p = _mm256_cvtepu16_epi32(_mm_loadu_si128((const __m128i *)(pix+i)));
+		__m256i s = _mm256_loadu_si256((const __m256i *)(sum+i));
+		__m128i c16 = _mm_loadu_si128((const __m128i *)(count+i));
+		__m256i c = _mm256_cvtepu16_epi32(c16);
+		
+		__m256i diff = _mm256_abs_epi32(_mm256_sub_epi32(s, _mm256_mullo_epi32(p, c)));
+		__m256i accept = _mm256_or_si256(_mm256_cmpeq_epi32(c, zero),
+		                                 _mm256_cmpgt_epi32(_mm256_mullo_epi32(thr, c), diff));
+		accept = _mm256_andnot_si256(_mm256_cmpeq_epi32(p, zero), accept);
+		
+		_mm256_storeu_si256((__m256i *)(sum+i), _mm256_add_epi32(s, _mm256_and_si256(p, accept)));
+		__m128i accept16 = _mm_packs_epi32(_mm256_castsi256_si128(accept), _mm256_extracti128_si256(accept, 1));
+		_mm_storeu_si128((__m128i *)(count+i), _mm_sub_epi16(c16, accept16));
+	}
+	
+	accumulate_scalar(pix+i, sum+i, count+i, n-i, threshold);
+}
+
+__attribute__((target("sse4.1")))
+static void accumulate_sse41(const uint16_t *pix, int32_t *sum, uint16_t *count, int n, int threshold) {
+	const __m128i zero = _mm_setzero_si128();
+	const __m128i thr = _mm_set1_epi32(threshold);
+	int i = 0;
+	
+	for(; i+4 <= n; i += 4) {
+		__m128i p = _mm_cvtepu16_epi32(_mm_loadl_epi64((const __m128i *)(pix+i)));
+		__m128i s = _mm_loadu_si128((const __m128i *)(sum+i));
+		__m128i c16 = _mm_loadl_epi64((const __m128i *)(count+i));
+		__m128i c = _mm_cvtepu16_epi32(c16);
+		
+		__m128i diff = _mm_abs_epi32(_mm_sub_epi32(s, _mm_mullo_epi32(p, c)));
+		__m128i accept = _mm_or_si128(_mm_cmpeq_epi32(c, zero),
+		                              _mm_cmpgt_epi32(_mm_mullo_epi32(thr, c), diff));
+		accept = _mm_andnot_si128(_mm_cmpeq_epi32(p, zero), accept);
+		
+		_mm_storeu_si128((__m128i *)(sum+i), _mm_add_epi32(s, _mm_and_si128(p, accept)));
+		_mm_storel_epi64((__m128i *)(count+i), _mm_sub_epi16(c16, _mm_packs_epi32(accept, accept)));
+	}
+	
+	accumulate_scalar(pix+i, sum+i, count+i, n-i, threshold);
+}
+#endif
+
+#ifdef ACCUMULATE_NEON
+static void accumulate_neon(const uint16_t *pix, int32_t *sum, uint16_t *count, int n, int threshold) {
+	const int32x4_t zero = vdupq_n_s32(0);
+	const int32x4_t thr = vdupq_n_s32(threshold);
+	int i = 0;
+	
+	for(; i+4 <= n; i += 4) {
+		int32x4_t p = vreinterpretq_s32_u32(vmovl_u16(vld1_u16(pix+i)));
+		int32x4_t s = vld1q_s32(sum+i);
+		uint16x4_t c16 = vld1_u16(count+i);
+		int32x4_t c = vreinterpretq_s32_u32(vmovl_u16(c16));
+		
+		int32x4_t diff = vabdq_s32(s, vmulq_s32(p, c));
+		uint32x4_t accept = vorrq_u32(vceqq_s32(c, zero), vcltq_s32(diff, vmulq_s32(thr, c)));
+		accept = vbicq_u32(accept, vceqq_s32(p, zero));
+		
+		vst1q_s32(sum+i, vaddq_s32(s, vandq_s32(p, vreinterpretq_s32_u32(accept))));
+		vst1_u16(count+i, vsub_u16(c16, vmovn_u32(accept)));
+	}
+	
+	accumulate_scalar(pix+i, sum+i, count+i, n-i, threshold);
+}
+#endif
+
+static accumulate_func impl = NULL;
+static const char *implname = NULL;
+
+static void select_impl(void) {
+	impl = accumulate_scalar;
+	implname = "scalar";
+	
+	if(getenv("RGBDSEND_NO_SIMD") != NULL)
+		return;
+	
+#ifdef ACCUMULATE_X86
+	__builtin_cpu_init();
+	if(__builtin_cpu_supports("avx2")) {
+		impl = accumulate_avx2;
+		implname = "avx2";
+	} else if(__builtin_cpu_supports("sse4.1")) {
+		impl = accumulate_sse41;
+		implname = "sse4.1";
+	}
+#endif
+#ifdef ACCUMULATE_NEON
+	impl = accumulate_neon;
+	implname = "neon";
+#endif
+}
+
+void accumulate_depth(const uint16_t *pix, int32_t *sum, uint16_t *count, int n, int threshold) {
+	if(impl == NULL)
+		select_impl();
+	
+	impl(pix, sum, count, n, threshold);
+}
+
+const char *accumulate_depth_impl(void) {
+	if(impl == NULL)
+		select_impl();
+	
+	return implname;
+}
@@ -0,0 +1,14 @@
+#ifndef ACCUMULATE_H
+#define ACCUMULATE_H
+
+#include <stdint.h>
+
+// Adds a depth frame of n pixels to the running sums. A pixel is accepted if
+// it is valid (non-zero) and either the first sample or within threshold of
+// the current average, i.e. |sum - pix*count| < threshold*count.
+// The implementation (AVX2, SSE4.1, NEON or scalar) is picked at runtime.
+void accumulate_depth(const uint16_t *pix, int32_t *sum, uint16_t *count, int n, int threshold);
+
+const char *accumulate_depth_impl(void);
+
+#endif
@@ -0,0 +1,176 @@
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <ctime>
+#include <unistd.h>
+
+#include "../synthetic.h"
+#include "../capture.h"
+#include "../pointcloud.h"
+#include "../cloud.h"
+#include "../config.h"
+#include "../accumulate.h"
+#include "../thumbnail.h"
+
+// Times every stage of the capture pipeline on synthetic frames, so no
+// sensor is needed. points/s counts input pixels for read_frame and
+// thumbnail and output points for the other stages.
+// usage: bench_pipeline [-s WxH]... [-n noise mm] [-i invalid ratio]
+//                       [-f frames] [-r repetitions] [-t threads]
+//                       [-o ascii|binary|compressed] [-m mesh step m] [-q]
+
+struct Options {
+	float noise;
+	float invalid;
+	int frames; // depth frames averaged per capture
+	int reps;
+	int threads;
+	int format;
+	float meshstep;
+	bool quantized;
+};
+
+static double elapsed_ms(struct timespec &start) {
+	struct timespec tp;
+	clock_gettime(CLOCK_MONOTONIC, &tp);
+	return (tp.tv_sec-start.tv_sec)*1000.0+(tp.tv_nsec-start.tv_nsec)/1000000.0;
+}
+
+static void report(const char *stage, double ms, int frames, double points) {
+	printf("%-20s %10.3f %12.1f %14.0f\n", stage, ms/frames, frames/(ms/1000.0), points/(ms/1000.0));
+}
+
+static void bench(int w, int h, Options &opt) {
+	SyntheticScene scene(w, h, opt.noise, opt.invalid, 1);
+	uint16_t *depth = new uint16_t[w*h*opt.frames];
+	uint8_t *rgb = new uint8_t[3*w*h];
+	struct timespec start;
+	double ms;
+	
+	for(int i = 0; i < opt.frames; i++)
+		scene.depth(depth+w*h*i);
+	scene.color(rgb);
+	
+	printf("\n%dx%d, %d frames per capture, %.1f mm noise, %.1f%% invalid, %d threads\n",
+		   w, h, opt.frames, opt.noise, opt.invalid*100.f, opt.threads);
+	printf("%-20s %10s %12s %14s\n", "stage", "ms/frame", "frames/s", "points/s");
+	
+	// read_frame: accumulating the depth frames and the color frame.
+	RawData raw;
+	clock_gettime(CLOCK_MONOTONIC, &start);
+	for(int r = 0; r < opt.reps; r++) {
+		raw.reset(w, h, w, h);
+		for(int i = 0; i < opt.frames; i++)
+			read_depth(depth+w*h*i, raw);
+		read_color(rgb, raw);
+	}
+	ms = elapsed_ms(start);
+	report("read_frame", ms, opt.reps*opt.frames, (double)opt.reps*opt.frames*w*h);
+	
+	RayTable rays;
+	rays.update(w, h, scene.hfov, scene.vfov, 0, 0, w, h);
+	PointCloud cloud(0, opt.quantized);
+	
+	clock_gettime(CLOCK_MONOTONIC, &start);
+	for(int r = 0; r < opt.reps; r++)
+		depth_to_pointcloud(cloud, raw, rays, 10.f, opt.meshstep, opt.threads);
+	ms = elapsed_ms(start);
+	report("depth_to_pointcloud", ms, opt.reps, (double)opt.reps*cloud.num);
+	if(opt.meshstep > 0.f)
+		printf("%-20s %d faces\n", "", cloud.numfaces);
+	
+	char filename[] = "bench_pipeline.tmp";
+	clock_gettime(CLOCK_MONOTONIC, &start);
+	for(int r = 0; r < opt.reps; r++)
+		export_cloud(filename, cloud, opt.format);
+	ms = elapsed_ms(start);
+	remove(filename);
+	report("export", ms, opt.reps, (double)opt.reps*cloud.num);
+	
+	Thumbnailer thumbnailer;
+	thumbnailer.setup(2, 20, 0);
+	clock_gettime(CLOCK_MONOTONIC, &start);
+	for(int r = 0; r < opt.reps; r++)
+		thumbnailer.encode(rgb, w, h);
+	ms = elapsed_ms(start);
+	report("thumbnail", ms, opt.reps, (double)opt.reps*w*h);
+	
+	delete[] depth;
+	delete[] rgb;
+}
+
+int main(int argc, char **argv) {
+	Options opt;
+	opt.noise = 5.f;
+	opt.invalid = .05f;
+	opt.frames = 30;
+	opt.reps = 5;
+	opt.threads = sysconf(_SC_NPROCESSORS_ONLN);
+	opt.format = CLOUD_FORMAT_PLY_BINARY;
+	opt.meshstep = 0.f;
+	opt.quantized = false;
+	
+	int sizes[16][2];
+	int nsizes = 0;
+	int c;
+	
+	while((c = getopt(argc, argv, "s:n:i:f:r:t:o:m:q")) != -1) {
+		switch(c) {
+		case 's':
+			if(nsizes < 16 && sscanf(optarg, "%dx%d", &sizes[nsizes][0], &sizes[nsizes][1]) == 2)
+				nsizes++;
+			break;
+		case 'n':
+			opt.noise = atof(optarg);
+			break;
+		case 'i':
+			opt.invalid = atof(optarg);
+			break;
+		case 'f':
+			opt.frames = atoi(optarg);
+			break;
+		case 'r':
+			opt.reps = atoi(optarg);
+			break;
+		case 't':
+			opt.threads = atoi(optarg);
+			break;
+		case 'o':
+			if(strcmp(optarg, "ascii") == 0)
+				opt.format = CLOUD_FORMAT_PLY_ASCII;
+			else if(strcmp(optarg, "compressed") == 0)
+				opt.format = CLOUD_FORMAT_COMPRESSED;
+			else
+				opt.format = CLOUD_FORMAT_PLY_BINARY;
+			break;
+		case 'm':
+			opt.meshstep = atof(optarg);
+			break;
+		case 'q':
+			opt.quantized = true;
+			break;
+		default:
+			printf("usage: %s [-s WxH]... [-n noise] [-i invalid] [-f frames] [-r reps] [-t threads] [-o format] [-m step] [-q]\n", argv[0]);
+			return 1;
+		}
+	}
+	
+	if(opt.frames < 1)
+		opt.frames = 1;
+	if(opt.reps < 1)
+		opt.reps = 1;
+	
+	if(nsizes == 0) {
+		int defaults[3][2] = {{320, 240}, {640, 480}, {1280, 1024}};
+		memcpy(sizes, defaults, sizeof(defaults));
+		nsizes = 3;
+	}
+	
+	printf("accumulate_depth: %s, export format: %s\n", accumulate_depth_impl(),
+		   opt.format == CLOUD_FORMAT_PLY_ASCII ? "ascii" : opt.format == CLOUD_FORMAT_COMPRESSED ? "compressed" : "binary");
+	
+	for(int i = 0; i < nsizes; i++)
+		bench(sizes[i][0], sizes[i][1], opt);
+	
+	return 0;
+}
@@ -0,0 +1,87 @@
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <ctime>
+#include <sys/stat.h>
+
+#include <cmath>
+
+#include "../cloud.h"
+#include "../config.h"
+
+// Compares the cloud writers on a synthetic point cloud and checks that the
+// compressed format decodes to the same cloud.
+// usage: bench_ply [points] [repetitions]
+
+static double elapsed_ms(struct timespec &start) {
+	struct timespec tp;
+	clock_gettime(CLOCK_MONOTONIC, &tp);
+	return (tp.tv_sec-start.tv_sec)*1000.0+(tp.tv_nsec-start.tv_nsec)/1000000.0;
+}
+
+// a tilted plane with some noise in millimetres, in row-major order like the
+// output of depth_to_pointcloud.
+static void fill_cloud(PointCloud &c) {
+	srand(1);
+	for(int i = 0; i < c.num; i++) {
+		int x = i%640, y = i/640;
+		float z = 1500.f+y*2+rand()%8;
+		c.set(i, (x-320)*z/525.f, (240-y)*z/525.f, z);
+		for(int k = 0; k < 3; k++)
+			c.rgb[3*i+k] = rand()%256;
+	}
+}
+
+static void bench(const char *name, char *filename, PointCloud &c, int format, int reps) {
+	struct timespec start;
+	clock_gettime(CLOCK_MONOTONIC, &start);
+	
+	for(int i = 0; i < reps; i++)
+		export_cloud(filename, c, format);
+	
+	double ms = elapsed_ms(start)/reps;
+	
+	struct stat st;
+	stat(filename, &st);
+	
+	printf("%-10s %10.2f ms %12ld bytes %12.0f points/s\n", name, ms, (long)st.st_size, c.num/(ms/1000.0));
+}
+
+static bool check_roundtrip(char *filename, PointCloud &c) {
+	FILE *f = fopen(filename, "rb");
+	PointCloud *d = decode_cloud(f);
+	fclose(f);
+	
+	if(d == NULL || d->num != c.num)
+		return false;
+	
+	bool ok = true;
+	for(int i = 0; i < c.num && ok; i++) {
+		for(int k = 0; k < 3 && ok; k++)
+			ok = fabsf(d->coord(i, k)-c.coord(i, k)) <= 0.5f && d->rgb[3*i+k] == c.rgb[3*i+k];
+	}
+	
+	delete d;
+	return ok;
+}
+
+int main(int argc, char **argv) {
+	int num = argc > 1 ? atoi(argv[1]) : 640*480;
+	int reps = argc > 2 ? atoi(argv[2]) : 5;
+	
+	PointCloud cloud(num);
+	fill_cloud(cloud);
+	
+	char filename[] = "bench_ply.tmp";
+	
+	printf("%d points, %d repetitions\n", num, reps);
+	bench("ascii", filename, cloud, CLOUD_FORMAT_PLY_ASCII, reps);
+	bench("binary", filename, cloud, CLOUD_FORMAT_PLY_BINARY, reps);
+	bench("compressed", filename, cloud, CLOUD_FORMAT_COMPRESSED, reps);
+	
+	bool ok = check_roundtrip(filename, cloud);
+	printf("compressed round trip: %s\n", ok ? "ok" : "FAILED");
+	remove(filename);
+	
+	return ok ? 0 : 1;
+}
@@ -1,47 +1,201 @@
 #include <stdlib.h>
+#include <unistd.h>
 #include <OpenNI.h>
 #include <cmath>
 #include <ctime>
-#include <jpeglib.h>
 
 #include "capture.h"
 #include "rgbdsend.h"
 #include "config.h"
+#include "accumulate.h"
+#include "stats.h"
+
+RawData::RawData() {
+	dresx = dresy = 0;
+	cresx = cresy = 0;
+	
+	d = NULL;
+	dframenums = NULL;
+	rgb = NULL;
+	color = NULL;
+	dcapacity = ccapacity = 0;
+	
+	dframenum = 0;
+	cframenum = 0;
+}
 
 RawData::RawData(int dresx, int dresy, int cresx, int cresy) {
+	d = NULL;
+	dframenums = NULL;
+	rgb = NULL;
+	color = NULL;
+	dcapacity = ccapacity = 0;
+	
+	reset(dresx, dresy, cresx, cresy);
+}
+
+RawData::~RawData() {
+	delete[] d;
+	delete[] dframenums;
+	delete[] rgb;
+	delete[] color;
+}
+
+CaptureFrames::CaptureFrames() {
+	memset(&depth, 0, sizeof(depth));
+	device = -1;
+	next = NULL;
+}
+
+CaptureFrames::~CaptureFrames() {
+	delete next;
+}
+
+void RawData::reset(int dresx, int dresy, int cresx, int cresy) {
 	this->dresx = dresx;
 	this->dresy = dresy;
 	
 	this->cresx = cresx;
 	this->cresy = cresy;
 	
-	r = new int[cresx*cresy];
-	g = new int[cresx*cresy];
-	b = new int[cresx*cresy];
-	
-	d = new long[dresx*dresy];
-	dframenums = new int[dresx*dresy];
+	// the buffers are kept between captures and only grow.
+	if(dresx*dresy > dcapacity) {
+		delete[] d;
+		delete[] dframenums;
+		
+		dcapacity = dresx*dresy;
+		d = new int32_t[dcapacity];
+		dframenums = new uint16_t[dcapacity];
+	}
 	
-	memset(r, 0, sizeof(int)*cresx*cresy);
-	memset(g, 0, sizeof(int)*cresx*cresy);
-	memset(b, 0, sizeof(int)*cresx*cresy);
+	if(cresx*cresy > ccapacity) {
+		delete[] rgb;
+		delete[] color;
+		
+		ccapacity = cresx*cresy;
+		rgb = new uint16_t[3*ccapacity];
+		color = new uint8_t[3*ccapacity];
+	}
 	
-	memset(d, 0, sizeof(long)*dresx*dresy);
-	memset(dframenums, 0, sizeof(int)*dresx*dresy);
+	memset(d, 0, sizeof(int32_t)*dresx*dresy);
+	memset(dframenums, 0, sizeof(uint16_t)*dresx*dresy);
+	memset(rgb, 0, sizeof(uint16_t)*3*cresx*cresy);
 		
+	dframenum = 0;
 	cframenum = 0;
 }
 
-RawData::~RawData() {
-	delete[] r;
-	delete[] g;
-	delete[] b;
-	delete[] d;
-	delete[] dframenums;
+static void set_maxres(openni::VideoStream &stream) {
+	const openni::Array<openni::VideoMode> &modes = stream.getSensorInfo().getSupportedVideoModes();
+	int mode = 0;
+	int max = 0;
+	
+	// 100 um depth only if there is no millimetre mode, as read() has to
+	// convert it. we don't want yuv422.
+	for(int pass = 0; pass < 2 && max == 0; pass++) {
+		for(int i = 0; i < modes.getSize(); i++) {
+			int res = modes[i].getResolutionX()*modes[i].getResolutionY()+modes[i].getFps(); // lower fps slightly prefered
+			openni::PixelFormat format = modes[i].getPixelFormat();
+			bool usable = pass == 0 ? format == openni::PIXEL_FORMAT_DEPTH_1_MM || format == openni::PIXEL_FORMAT_RGB888
+									: format == openni::PIXEL_FORMAT_DEPTH_100_UM;
+			if(res > max && usable) {
+				max = res;
+				mode = i;
+			}
+		}
+	}
+	
+	stream.setVideoMode(modes[mode]);
+}
+
+static void set_closestres(openni::VideoStream &stream, const openni::VideoMode &target) {
+	const openni::Array<openni::VideoMode> &modes = stream.getSensorInfo().getSupportedVideoModes();
+	int mode = 0;
+	int min = 1<<16;
+	
+	for(int i = 0; i < modes.getSize(); i++) {
+		int dx = target.getResolutionX()-modes[i].getResolutionX();
+		dx *= dx;
+		int dy = target.getResolutionY()-modes[i].getResolutionY();
+		dy *= dy;
+		
+		int res = dx+dy+modes[i].getFps(); // higher fps slightly prefered
+		if(res < min && (modes[i].getPixelFormat() == openni::PIXEL_FORMAT_DEPTH_100_UM // we don't want yuv422.
+			|| modes[i].getPixelFormat() == openni::PIXEL_FORMAT_DEPTH_1_MM
+			|| modes[i].getPixelFormat() == openni::PIXEL_FORMAT_RGB888)) {
+			min = res;
+			mode = i;
+		}
+	}
+	
+	stream.setVideoMode(modes[mode]);
+}
+
+static bool set_cropping(openni::VideoStream *s, Config &conf) {
+	int x, y, w, h;
+	
+	crop_window(conf, s->getVideoMode().getResolutionX(), s->getVideoMode().getResolutionY(), &x, &y, &w, &h);
+	
+	if(s->setCropping(x, y, w, h) != openni::STATUS_OK) {
+		printf("OpenNI Error: Invalid cropping parameters!\n");
+		return false;
+	}
+	
+	return true;
+}
+
+OpenNISource::OpenNISource() {
+	device = new openni::Device;
+	depth = new openni::VideoStream;
+	color = new openni::VideoStream;
+	frame = new openni::VideoFrameRef;
+	left[0] = left[1] = 0;
+	
+	mm = NULL;
+	mmsize = 0;
 }
 
-bool init_openni_device(const char *uri, openni::Device *device, openni::VideoStream *depth, openni::VideoStream *color) {
-	openni::Status rc = device->open(uri);
+OpenNISource::~OpenNISource() {
+	frame->release();
+	depth->destroy();
+	color->destroy();
+	device->close();
+	
+	delete frame;
+	delete depth;
+	delete color;
+	delete device;
+	delete[] mm;
+}
+
+bool init_openni(void) {
+	openni::Status rc = openni::OpenNI::initialize();
+	if(rc != openni::STATUS_OK)	{
+		printf("OpenNI: Initialize failed\n%s", openni::OpenNI::getExtendedError());
+		return false;
+	}
+	
+	return true;
+}
+
+bool openni_device_uris(std::vector<std::string> &uris) {
+	if(!init_openni())
+		return false;
+	
+	openni::Array<openni::DeviceInfo> devices;
+	openni::OpenNI::enumerateDevices(&devices);
+	
+	for(int i = 0; i < devices.getSize(); i++)
+		uris.push_back(devices[i].getUri());
+	
+	return true;
+}
+
+bool OpenNISource::open(const char *uri, Config *conf) {
+	if(!init_openni())
+		return false;
+	
+	openni::Status rc = device->open(uri != NULL ? uri : openni::ANY_DEVICE);
 	if(rc != openni::STATUS_OK) {
 		printf("OpenNI: Couldn't open device\n%s", openni::OpenNI::getExtendedError());
 		return false;
@@ -64,234 +218,286 @@ bool init_openni_device(const char *uri, openni::Device *device, openni::VideoSt
 		return false;
 	}
 	
-	return true;
-}
-
-static void set_cropping(openni::VideoStream *s, int r, int l, int t, int b) {
-	int w = s->getVideoMode().getResolutionX();
-	int h = s->getVideoMode().getResolutionY();
-	int cl = w*l/100;
-	int cr = w*r/100;
-	int ct = h*t/100;
-	int cb = h*b/100;
-	
-	if(s->setCropping(cl, ct, w-cl-cr, h-ct-cb) != openni::STATUS_OK) {
-		printf("OpenNI Error: Invalid cropping parameters!\n");
-		exit(1);
-	}
-}
-
-void init_openni(openni::Device *device, openni::VideoStream *depth, openni::VideoStream *color, Config &conf) {
-	openni::Status rc = openni::OpenNI::initialize();
-	if(rc != openni::STATUS_OK)	{
-		printf("OpenNI: Initialize failed\n%s", openni::OpenNI::getExtendedError());
-		exit(1);
+	// recordings are read as fast as possible, see readPlayback().
+	if(device->isFile()) {
+		device->getPlaybackControl()->setRepeatEnabled(false);
+		device->getPlaybackControl()->setSpeed(-1);
 	}
 	
-	if(!init_openni_device(openni::ANY_DEVICE, device, depth, color))
-		exit(1);
+	if(conf == NULL)
+		return true;
 	
 	if(device->isImageRegistrationModeSupported(openni::IMAGE_REGISTRATION_DEPTH_TO_COLOR))	
 		device->setImageRegistrationMode(openni::IMAGE_REGISTRATION_DEPTH_TO_COLOR);
 	else
 		printf("OpenNI Warning: depth to image registration not supported by device!\nColor values will appear shifted.\n");
 	
-	set_cropping(color, conf.crop_left, conf.crop_right, conf.crop_top, conf.crop_bottom);
-	set_cropping(depth, conf.crop_left, conf.crop_right, conf.crop_top, conf.crop_bottom);
+	return set_cropping(color, *conf) && set_cropping(depth, *conf);
 }
 
-void set_maxres(openni::VideoStream &stream) {
-	const openni::Array<openni::VideoMode> &modes = stream.getSensorInfo().getSupportedVideoModes();
-	int mode = 0;
-	int max = 0;
+// the device stays open, so this is much faster than opening it again.
+bool OpenNISource::setCropping(Config &conf) {
+	if(device->isFile())
+		return FrameSource::setCropping(conf);
 	
-	for(int i = 0; i < modes.getSize(); i++) {
-		int res = modes[i].getResolutionX()*modes[i].getResolutionY()+modes[i].getFps(); // lower fps slightly prefered
-		if(res > max && (modes[i].getPixelFormat() == openni::PIXEL_FORMAT_DEPTH_100_UM // we don't want yuv422.
-			|| modes[i].getPixelFormat() == openni::PIXEL_FORMAT_DEPTH_1_MM
-			|| modes[i].getPixelFormat() == openni::PIXEL_FORMAT_RGB888)) {
-			max = res;
-			mode = i;
-		}
+	return set_cropping(color, conf) && set_cropping(depth, conf);
+}
+
+void OpenNISource::start(int streams) {
+	if(streams & SOURCE_DEPTH) {
+		depth->start();
+		left[0] = frameCount(SOURCE_DEPTH);
+	}
+	if(streams & SOURCE_COLOR) {
+		color->start();
+		left[1] = frameCount(SOURCE_COLOR);
 	}
-	
-	stream.setVideoMode(modes[mode]);
 }
 
-void set_closestres(openni::VideoStream &stream, const openni::VideoMode &target) {
-	const openni::Array<openni::VideoMode> &modes = stream.getSensorInfo().getSupportedVideoModes();
-	int mode = 0;
-	int min = 1<<16;
+void OpenNISource::stop(int streams) {
+	if(streams & SOURCE_DEPTH)
+		depth->stop();
+	if(streams & SOURCE_COLOR)
+		color->stop();
+}
+
+int OpenNISource::read(Frame *f, int streams, int timeoutms) {
+	openni::VideoStream *s[2];
+	int n = 0;
+	int ready = -1;
 	
-	for(int i = 0; i < modes.getSize(); i++) {
-		int dx = target.getResolutionX()-modes[i].getResolutionX();
-		dx *= dx;
-		int dy = target.getResolutionY()-modes[i].getResolutionY();
-		dy *= dy;
-		
-		int res = dx+dy+modes[i].getFps(); // higher fps slightly prefered
-		if(res < min && (modes[i].getPixelFormat() == openni::PIXEL_FORMAT_DEPTH_100_UM // we don't want yuv422.
-			|| modes[i].getPixelFormat() == openni::PIXEL_FORMAT_DEPTH_1_MM
-			|| modes[i].getPixelFormat() == openni::PIXEL_FORMAT_RGB888)) {
-			min = res;
-			mode = i;
-		}
+	if(device->isFile())
+		return readPlayback(f, streams);
+	
+	if(streams & SOURCE_DEPTH)
+		s[n++] = depth;
+	if(streams & SOURCE_COLOR)
+		s[n++] = color;
+	
+	if(n == 0 || openni::OpenNI::waitForAnyStream(s, n, &ready, timeoutms) != openni::STATUS_OK)
+		return 0;
+	
+	if(s[ready]->readFrame(frame) != openni::STATUS_OK)
+		return 0;
+	
+	fillFrame(f, s[ready] == depth);
+	
+	return 1;
+}
+
+// frames are handed out in millimetres, like every source does. sensors
+// without a millimetre mode and some recordings give 100 um.
+void OpenNISource::fillFrame(Frame *f, bool isdepth) {
+	f->stream = isdepth ? SOURCE_DEPTH : SOURCE_COLOR;
+	f->width = frame->getWidth();
+	f->height = frame->getHeight();
+	f->data = frame->getData();
+	
+	if(!isdepth || frame->getVideoMode().getPixelFormat() != openni::PIXEL_FORMAT_DEPTH_100_UM)
+		return;
+	
+	int n = f->width*f->height;
+	if(n > mmsize) {
+		delete[] mm;
+		mm = new uint16_t[n];
+		mmsize = n;
 	}
 	
-	stream.setVideoMode(modes[mode]);
+	const uint16_t *um = (const uint16_t *)frame->getData();
+	for(int i = 0; i < n; i++)
+		mm[i] = (um[i]+5)/10;
+	f->data = mm;
 }
 
-void read_frame(openni::VideoFrameRef &frame, RawData &data) {
-	openni::DepthPixel *depthpix;
-	openni::RGB888Pixel *clrpix;
-	int x, y;
-	
-	
-	switch (frame.getVideoMode().getPixelFormat()) {
-	case openni::PIXEL_FORMAT_DEPTH_1_MM:
-	case openni::PIXEL_FORMAT_DEPTH_100_UM:
-		depthpix = (openni::DepthPixel*)frame.getData();
-		for(y = 0; y < data.dresy; y++) {
-			for(x = 0; x < data.dresx; x++) {
-				int idx = x+data.dresx*y;
-				
-				float curavg = data.d[idx]/(float)data.dframenums[idx];
-				
-				if(depthpix[idx] == 0)
-					continue;
-				
-				if(data.d[idx] == 0 || fabs(curavg-depthpix[idx]) < rgbdsend::depth_averaging_threshold) {
-					data.d[idx] += depthpix[idx];
-					data.dframenums[idx]++;
-				}		
-				
-			}
-		}
-		break;
-	case openni::PIXEL_FORMAT_RGB888:
-		if(data.cframenum < 1) {
-			clrpix = (openni::RGB888Pixel*)frame.getData();
-			for(y = 0; y < data.cresy; y++) {
-				for(x = 0; x < data.cresx; x++) {
-					int idx = x+data.cresx*y;
-					
-					data.r[idx] += clrpix[idx].r;
-					data.g[idx] += clrpix[idx].g;
-					data.b[idx] += clrpix[idx].b;			
-					
-				}
-			}
-		
-			data.cframenum++;
-		}
-		break;
-	default:
-		printf("Unknown format\n");
-	}	
+// at speed -1 the player hands out the next frame as soon as it's read, so
+// there's nothing to wait for. the frame counts tell where the recording
+// ends, instead of a timeout. the stream that is further behind is read
+// first, to stay close to the order of the recording.
+int OpenNISource::readPlayback(Frame *f, int streams) {
+	int total[2] = {frameCount(SOURCE_DEPTH), frameCount(SOURCE_COLOR)};
+	bool d = (streams & SOURCE_DEPTH) && left[0] > 0;
+	bool c = (streams & SOURCE_COLOR) && left[1] > 0;
+	
+	if(!d && !c)
+		return 0;
+	
+	if(d && c)
+		d = (long long)left[0]*total[1] >= (long long)left[1]*total[0];
+	
+	openni::VideoStream *s = d ? depth : color;
+	if(s->readFrame(frame) != openni::STATUS_OK)
+		return 0;
+	
+	left[d ? 0 : 1]--;
+	
+	fillFrame(f, d);
+	
+	return 1;
 }
 
-void capture(openni::VideoStream **streams, int streamcount, RawData &raw, int *framecounts) {
-	openni::VideoFrameRef frame;
-	openni::Status rc;
+StreamInfo OpenNISource::info(int stream) {
+	openni::VideoStream *s = stream == SOURCE_DEPTH ? depth : color;
+	openni::VideoMode mode = s->getVideoMode();
+	StreamInfo i;
+	
+	i.resx = mode.getResolutionX();
+	i.resy = mode.getResolutionY();
+	i.fps = mode.getFps();
+	i.hfov = s->getHorizontalFieldOfView();
+	i.vfov = s->getVerticalFieldOfView();
+	
+	if(!s->getCropping(&i.cropx, &i.cropy, &i.cropw, &i.croph)) {
+		i.cropx = 0;
+		i.cropy = 0;
+		i.cropw = i.resx;
+		i.croph = i.resy;
+	}
 	
-	int *framestotake = new int[streamcount];
+	return i;
+}
+
+bool OpenNISource::recordOni(const char *filename, int ms) {
+	openni::Recorder recorder;
 	
-	for(int i = 0; i < streamcount; i++) {
-		streams[i]->start();
-		framestotake[i] = framecounts[i];
-		printf("take %d frames from stream %d\n", framestotake[i], i);
+	depth->start();
+	color->start();
+	openni::Status rc = recorder.create(filename);	
+	if(rc != openni::STATUS_OK) {
+		printf("Error: Failed to open '%s' for writing!\n%s", filename, openni::OpenNI::getExtendedError());
+		return false;
 	}
 	
-	int sc = streamcount;
+	recorder.attach(*color);
+	recorder.attach(*depth);
+	recorder.start();
 	
-	while(sc) {
-		int readyStream = -1;
-		rc = openni::OpenNI::waitForAnyStream(streams, sc, &readyStream, rgbdsend::read_wait_timeout);
-		if (rc != openni::STATUS_OK) {
-			printf("\nONI file was read.\n");
-			break;
-		}
-		
-		streams[readyStream]->readFrame(&frame);
-		read_frame(frame, raw);
-// 		if(framestotake[readyStream] > 0) {
-// 			streams[readyStream]->readFrame(&frame);
-// 			framestotake[readyStream]--;
-// 			read_frame(frame, raw);
-// 			
-// 			if(framestotake[readyStream] == 0) {
-// 				streams[readyStream]->stop();
-// 				
-// 				sc--;
-// 				streams[readyStream] = streams[sc];
-// 				framestotake[readyStream] = framestotake[sc];
-// 				printf("\n");
-// 			}			
-// 		}
+	struct timespec	start, tp;
+	clock_gettime(CLOCK_MONOTONIC, &start);
+	
+	do {
+		usleep(100);
+		clock_gettime(CLOCK_MONOTONIC, &tp);
+	} while((tp.tv_sec-start.tv_sec)*1000+(tp.tv_nsec-start.tv_nsec)/1000000 < ms);
 		
-// 		printf("\rframes left: ");
-// 		for(int i = 0; i < sc; i++)
-// 			printf("%d ", framestotake[i]);	
+	
+	recorder.stop();
+	color->stop();
+	depth->stop();
+	recorder.destroy();
+	
+	return true;
+}
+
+int OpenNISource::frameCount(int stream) {
+	if(!device->isFile())
+		return 0;
+	
+	return device->getPlaybackControl()->getNumberOfFrames(stream == SOURCE_DEPTH ? *depth : *color);
+}
+
+void read_depth(const uint16_t *pix, RawData &data) {
+	accumulate_depth(pix, data.d, data.dframenums, data.dresx*data.dresy, rgbdsend::depth_averaging_threshold);
+	data.dframenum++;
+}
+
+void read_color(const uint8_t *rgb, RawData &data) {
+	if(data.cframenum >= 1)
+		return;
+	
+	for(int i = 0; i < 3*data.cresx*data.cresy; i++)
+		data.rgb[i] += rgb[i];
+	
+	data.cframenum++;
+}
+
+void average_color(RawData &data) {
+	int n = 3*data.cresx*data.cresy;
+	
+	if(data.cframenum == 0) {
+		memset(data.color, 0, n);
+		return;
 	}
 	
-	for(int i = 0; i < streamcount; i++) {
-		streams[i]->stop();
+	// only one color frame is accumulated at the moment. no need to divide.
+	if(data.cframenum == 1) {
+		for(int i = 0; i < n; i++)
+			data.color[i] = data.rgb[i];
+		return;
 	}
-	printf("\n");	
+	
+	for(int i = 0; i < n; i++)
+		data.color[i] = data.rgb[i]/data.cframenum;
 }
 
-int capture_thumbnail(unsigned char **thumbbuf, long unsigned int *memsize, openni::VideoStream &color) {
-	openni::Status rc;
-	int readyStream = -1;
-	openni::VideoFrameRef frame;
+bool read_frame(Frame &frame, RawData &data) {
+	bool depth = frame.stream == SOURCE_DEPTH;
+	
+	if(frame.width != (depth ? data.dresx : data.cresx) || frame.height != (depth ? data.dresy : data.cresy)) {
+		stats_add(STAT_FRAMES_REJECTED, 1);
+		return false;
+	}
+	
+	if(depth)
+		read_depth((const uint16_t *)frame.data, data);
+	else
+		read_color((const uint8_t *)frame.data, data);
+	
+	return true;
+}
 
-	color.start();
+void capture(FrameSource &source, RawData &raw) {
+	Frame frame;
+	int streams = SOURCE_DEPTH | SOURCE_COLOR;
 	
+	source.start(streams);
 	
-	openni::VideoStream *streams[] = {&color};
-	rc = openni::OpenNI::waitForAnyStream(streams, 1, &readyStream, rgbdsend::read_wait_timeout);
-	if (rc != openni::STATUS_OK) {
-		printf("\nRecording thumbnail timed out.\n");
-		return 0;
+	// the per pixel frame counts are 16 bit.
+	while(raw.dframenum < 65535 && source.read(&frame, streams, rgbdsend::read_wait_timeout)) {
+		read_frame(frame, raw);
+		
+		// only the first color frame is used. don't decode the rest.
+		if((streams & SOURCE_COLOR) && raw.cframenum > 0) {
+			source.stop(SOURCE_COLOR);
+			streams = SOURCE_DEPTH;
+		}
 	}
 	
-	color.readFrame(&frame);
+	printf("\nONI file was read.\n");
 	
-	openni::RGB888Pixel *pixels = (openni::RGB888Pixel *)frame.getData();
+	source.stop(SOURCE_DEPTH | SOURCE_COLOR);
+	printf("\n");	
+}
+
+bool capture_live(FrameSource &source, RawData &raw, int ms) {
+	Frame frame;
 	
-	jpeg_compress_struct cinfo;
-	jpeg_error_mgr jerr;
-	cinfo.err = jpeg_std_error(&jerr);
+	source.start(SOURCE_DEPTH | SOURCE_COLOR);
 	
-	jpeg_create_compress(&cinfo);
-	*thumbbuf = NULL;
-	*memsize = 0;
-	jpeg_mem_dest(&cinfo, thumbbuf, memsize);
+	struct timespec	start, tp;
+	clock_gettime(CLOCK_MONOTONIC, &start);
 	
-	cinfo.image_width = frame.getWidth();
-	cinfo.image_height = frame.getHeight();
-	cinfo.input_components = 3;
-	cinfo.in_color_space = JCS_RGB;
+	// the per pixel frame counts are 16 bit. unpaced sources get there.
+	long tt = 0;
+	while((tt < ms || raw.cframenum == 0) && raw.dframenum < 65535) {
+		if(!source.read(&frame, SOURCE_DEPTH | SOURCE_COLOR, rgbdsend::read_wait_timeout)) {
+			stats_add(STAT_READ_TIMEOUTS, 1);
+			printf("Capture Error: Timed out waiting for frames.\n");
+			break;
+		}
+		
+		read_frame(frame, raw);
+		
+		clock_gettime(CLOCK_MONOTONIC, &tp);
+		tt = (tp.tv_sec-start.tv_sec)*1000+(tp.tv_nsec-start.tv_nsec)/1000000;
+	}
 	
-	jpeg_set_defaults(&cinfo);
-	jpeg_set_quality(&cinfo, 20, true);
-	jpeg_start_compress(&cinfo, true);
+	source.stop(SOURCE_DEPTH | SOURCE_COLOR);
 	
-	while(cinfo.next_scanline < cinfo.image_height) {
-		JSAMPROW rowpointer;
-		rowpointer = (JSAMPROW) &pixels[cinfo.next_scanline*cinfo.image_width];
-		jpeg_write_scanlines(&cinfo, &rowpointer, 1);
-	}
+	printf("Captured %d depth frames in %ld ms.\n", raw.dframenum, tt);
 	
-	jpeg_finish_compress(&cinfo);
-	jpeg_destroy_compress(&cinfo);
-	color.stop();
-	return 1;
+	return raw.dframenum > 0 && raw.cframenum > 0;
 }
 
-void cleanup_openni(openni::Device &device, openni::VideoStream &depth, openni::VideoStream &color) {
-	depth.destroy();
-	color.destroy();
-	device.close();
+void cleanup_openni(void) {
 	openni::OpenNI::shutdown();
 }
@@ -1,6 +1,12 @@
 #ifndef CAPTURE_H
 #define CAPTURE_H
 
+#include <stdint.h>
+#include <vector>
+#include <string>
+
+#include "framesource.h"
+
 namespace openni {
 	class VideoFrameRef;
 	class VideoStream;
@@ -11,36 +17,97 @@ class Config;
 
 class RawData {
 public:
+	RawData();
 	RawData(int dresx, int dresy, int cresx, int cresy);
 	~RawData();
+	
+	// clears the accumulators for a new capture. memory is reused if the
+	// buffers are big enough already.
+	void reset(int dresx, int dresy, int cresx, int cresy);
+	
 	// Depth
 	
 	int dresx;
 	int dresy;
 	
-	long *d;
-	int *dframenums; // some pixels are rejected for the average so
-					 // the number of frames is pixel dependent
+	int32_t *d;
+	uint16_t *dframenums; // some pixels are rejected for the average so
+						  // the number of frames is pixel dependent
+	int dframenum; // frames read
 	
 	// Color
 	
 	int cresx; 
 	int cresy; 
 	
-	int *r;
-	int *g;
-	int *b;
+	uint16_t *rgb; // interleaved r, g, b sums
+	uint8_t *color; // rgb divided by cframenum, see average_color()
 	int cframenum;	
+	
+private:
+	int dcapacity;
+	int ccapacity;
+};
+
+// A direct capture from a sensor, accumulated but not converted yet.
+struct CaptureFrames {
+	CaptureFrames();
+	~CaptureFrames(); // deletes next as well
+	
+	RawData raw;
+	StreamInfo depth; // the stream raw came from
+	int device; // -1 if it's the only sensor
+	CaptureFrames *next; // another sensor's frames for the same cloud or NULL
 };
 
-bool init_openni_device(const char *dev, openni::Device *device, openni::VideoStream *depth, openni::VideoStream *color);
-void init_openni(openni::Device *device, openni::VideoStream *depth, openni::VideoStream *color, Config &conf);
-void set_maxres(openni::VideoStream &stream);
-void set_closestres(openni::VideoStream &stream, const openni::VideoMode &target);
-void read_frame(openni::VideoFrameRef &frame, RawData &data);
-void capture(openni::VideoStream **streams, int streamcount, RawData &data, int *framecounts);
+// A sensor or an ONI file opened through OpenNI.
+class OpenNISource : public FrameSource {
+public:
+	OpenNISource();
+	~OpenNISource();
+	
+	// uri is a device uri, an ONI file or NULL for any device. conf sets up
+	// cropping and registration of a sensor.
+	bool open(const char *uri, Config *conf);
+	void start(int streams);
+	void stop(int streams);
+	int read(Frame *frame, int streams, int timeoutms);
+	StreamInfo info(int stream);
+	bool recordOni(const char *filename, int ms);
+	bool setCropping(Config &conf);
+	
+	// number of frames of a stream in an ONI file.
+	int frameCount(int stream);
+	
+private:
+	int readPlayback(Frame *frame, int streams);
+	void fillFrame(Frame *f, bool isdepth);
+	
+	openni::Device *device;
+	openni::VideoStream *depth;
+	openni::VideoStream *color;
+	openni::VideoFrameRef *frame;
+	int left[2]; // frames of an ONI not read yet
+	
+	uint16_t *mm; // 100 um depth converted to millimetres
+	int mmsize;
+};
 
-int capture_thumbnail(unsigned char **thumbbuf, long unsigned int *size, openni::VideoStream &color);
+// accumulate a depth frame or a packed rgb frame of data's resolution.
+void read_depth(const uint16_t *pix, RawData &data);
+void read_color(const uint8_t *rgb, RawData &data);
+// fills raw.color once the color frames are accumulated.
+void average_color(RawData &raw);
+// accumulates frame if it has the resolution of its stream in data. others,
+// e.g. from before the cropping changed, are counted as rejected and skipped.
+bool read_frame(Frame &frame, RawData &data);
+// accumulates all frames of a recording until it ends.
+void capture(FrameSource &source, RawData &data);
+// accumulates frames of the running source for ms milliseconds.
+bool capture_live(FrameSource &source, RawData &raw, int ms);
 
-void cleanup_openni(openni::Device &device, openni::VideoStream &depth, openni::VideoStream &color);
+bool init_openni(void);
+// uris of all attached sensors.
+bool openni_device_uris(std::vector<std::string> &uris);
+void cleanup_openni(void);
 #endif
\ No newline at end of file
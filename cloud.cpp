@@ -0,0 +1,651 @@
+#include <cstdio>
+#include <cstring>
+#include <cerrno>
+#include <cmath>
+#include <zlib.h>
+
+#include "cloud.h"
+#include "config.h"
+
+PointCloud::PointCloud(int num, bool quantized) {
+	this->quantized = quantized;
+	
+	xyz = NULL;
+	xyz16 = NULL;
+	rgb = NULL;
+	
+	faces = NULL;
+	numfaces = 0;
+	
+	refs = 1;
+	
+	allocate(num);
+}
+
+PointCloud::~PointCloud() {
+	delete[] xyz;
+	delete[] xyz16;
+	delete[] rgb;
+	delete[] faces;
+}
+
+void PointCloud::allocate(int num) {
+	delete[] xyz;
+	delete[] xyz16;
+	delete[] rgb;
+	
+	xyz = quantized ? NULL : new float[3*num];
+	xyz16 = quantized ? new int16_t[3*num] : NULL;
+	rgb = new uint8_t[3*num];
+	
+	this->num = num;
+}
+
+
+static inline uint64_t voxel_key(float x, float y, float z, float inv) {
+	// 21 bits per axis, centered around the origin.
+	uint64_t ix = (uint64_t)((int64_t)floorf(x*inv)+(1<<20)) & 0x1fffff;
+	uint64_t iy = (uint64_t)((int64_t)floorf(y*inv)+(1<<20)) & 0x1fffff;
+	uint64_t iz = (uint64_t)((int64_t)floorf(z*inv)+(1<<20)) & 0x1fffff;
+	
+	return ix | iy << 21 | iz << 42;
+}
+
+void voxel_downsample(PointCloud &c, float voxelsize) {
+	if(c.num == 0 || voxelsize <= 0.f)
+		return;
+	
+	float inv = 1.f/voxelsize;
+	
+	int bits = 1;
+	while((1 << bits) < 2*c.num)
+		bits++;
+	
+	int tablesize = 1 << bits;
+	uint64_t *keys = new uint64_t[tablesize];
+	int *slots = new int[tablesize];
+	memset(slots, -1, sizeof(int)*tablesize);
+	
+	// cells are numbered in order of their first point, so the output keeps
+	// the order of the input.
+	float *sx = new float[c.num];
+	float *sy = new float[c.num];
+	float *sz = new float[c.num];
+	uint32_t *sr = new uint32_t[c.num];
+	uint32_t *sg = new uint32_t[c.num];
+	uint32_t *sb = new uint32_t[c.num];
+	int *count = new int[c.num];
+	int *cellof = c.numfaces > 0 ? new int[c.num] : NULL;
+	int cells = 0;
+	
+	for(int i = 0; i < c.num; i++) {
+		float x = c.coord(i, 0), y = c.coord(i, 1), z = c.coord(i, 2);
+		uint64_t key = voxel_key(x, y, z, inv);
+		uint32_t h = (key*0x9e3779b97f4a7c15ULL) >> (64-bits);
+		
+		while(slots[h] != -1 && keys[h] != key)
+			h = (h+1) & (tablesize-1);
+		
+		int cell = slots[h];
+		if(cell == -1) {
+			cell = cells++;
+			slots[h] = cell;
+			keys[h] = key;
+			
+			sx[cell] = sy[cell] = sz[cell] = 0.f;
+			sr[cell] = sg[cell] = sb[cell] = 0;
+			count[cell] = 0;
+		}
+		
+		sx[cell] += x;
+		sy[cell] += y;
+		sz[cell] += z;
+		sr[cell] += c.rgb[3*i];
+		sg[cell] += c.rgb[3*i+1];
+		sb[cell] += c.rgb[3*i+2];
+		count[cell]++;
+		
+		if(cellof != NULL)
+			cellof[i] = cell;
+	}
+	
+	for(int i = 0; i < cells; i++) {
+		float w = 1.f/count[i];
+		
+		c.set(i, sx[i]*w, sy[i]*w, sz[i]*w);
+		c.rgb[3*i] = (sr[i]+count[i]/2)/count[i];
+		c.rgb[3*i+1] = (sg[i]+count[i]/2)/count[i];
+		c.rgb[3*i+2] = (sb[i]+count[i]/2)/count[i];
+	}
+	
+	if(cellof != NULL) {
+		int n = 0;
+		
+		for(int i = 0; i < c.numfaces; i++) {
+			int32_t a = cellof[c.faces[3*i]];
+			int32_t b = cellof[c.faces[3*i+1]];
+			int32_t d = cellof[c.faces[3*i+2]];
+			
+			if(a == b || b == d || a == d)
+				continue;
+			
+			c.faces[3*n] = a;
+			c.faces[3*n+1] = b;
+			c.faces[3*n+2] = d;
+			n++;
+		}
+		
+		printf("Kept %d of %d faces.\n", n, c.numfaces);
+		c.numfaces = n;
+	}
+	
+	printf("Downsampled %d points to %d voxels.\n", c.num, cells);
+	c.num = cells;
+	
+	delete[] keys;
+	delete[] slots;
+	delete[] sx;
+	delete[] sy;
+	delete[] sz;
+	delete[] sr;
+	delete[] sg;
+	delete[] sb;
+	delete[] count;
+	delete[] cellof;
+}
+
+static int ply_header(char *buf, const char *format, int num, int numfaces) {
+	return sprintf(buf, "ply\n"
+			   "format %s 1.0\n"
+			   "comment created by rgbdsend\n"
+			   "element vertex %d\n"
+			   "property float32 x\n"
+			   "property float32 y\n"
+			   "property float32 z\n"
+			   "property uint8 red\n"
+			   "property uint8 green\n"
+			   "property uint8 blue\n"
+			   "element face %d\n"
+			   "property list uint8 int32 vertex_indices\n"
+			   "end_header\n", format, num, numfaces);
+}
+
+PointCloud *merge_clouds(PointCloud **clouds, int n) {
+	int num = 0, numfaces = 0;
+	
+	for(int i = 0; i < n; i++) {
+		num += clouds[i]->num;
+		numfaces += clouds[i]->numfaces;
+	}
+	
+	PointCloud *m = new PointCloud(num, n > 0 && clouds[0]->quantized);
+	if(numfaces > 0)
+		m->faces = new int32_t[3*numfaces];
+	m->numfaces = numfaces;
+	
+	int p = 0, f = 0;
+	for(int i = 0; i < n; i++) {
+		PointCloud &c = *clouds[i];
+		
+		for(int j = 0; j < c.num; j++)
+			m->set(p+j, c.coord(j, 0), c.coord(j, 1), c.coord(j, 2));
+		memcpy(m->rgb+3*p, c.rgb, 3*c.num);
+		
+		for(int j = 0; j < 3*c.numfaces; j++)
+			m->faces[3*f+j] = c.faces[j]+p;
+		
+		p += c.num;
+		f += c.numfaces;
+	}
+	
+	return m;
+}
+
+void retain_cloud(PointCloud *c) {
+	__sync_fetch_and_add(&c->refs, 1);
+}
+
+void release_cloud(PointCloud *c) {
+	if(c != NULL && __sync_sub_and_fetch(&c->refs, 1) == 0)
+		delete c;
+}
+
+void transform_cloud(PointCloud &c, const SensorPose &pose) {
+	float a[3];
+	for(int k = 0; k < 3; k++)
+		a[k] = pose.rotation[k]*(float)M_PI/180.f;
+	
+	float sx = sinf(a[0]), cx = cosf(a[0]);
+	float sy = sinf(a[1]), cy = cosf(a[1]);
+	float sz = sinf(a[2]), cz = cosf(a[2]);
+	
+	// rotation about z times y times x, so x is applied first.
+	float r[3][3] = {
+		{cz*cy, cz*sy*sx-sz*cx, cz*sy*cx+sz*sx},
+		{sz*cy, sz*sy*sx+cz*cx, sz*sy*cx-cz*sx},
+		{-sy, cy*sx, cy*cx}
+	};
+	float t[3] = {pose.position[0]*1000.f, pose.position[1]*1000.f, pose.position[2]*1000.f}; // clouds are in millimetres
+	
+	for(int i = 0; i < c.num; i++) {
+		float p[3] = {c.coord(i, 0), c.coord(i, 1), c.coord(i, 2)};
+		float q[3];
+		
+		for(int k = 0; k < 3; k++)
+			q[k] = r[k][0]*p[0]+r[k][1]*p[1]+r[k][2]*p[2]+t[k];
+		
+		c.set(i, q[0], q[1], q[2]);
+	}
+}
+
+static inline uint8_t *put_uint32_le(uint8_t *p, uint32_t u) {
+	p[0] = u;
+	p[1] = u >> 8;
+	p[2] = u >> 16;
+	p[3] = u >> 24;
+	return p+4;
+}
+
+static inline uint8_t *put_float_le(uint8_t *p, float v) {
+	uint32_t u;
+	memcpy(&u, &v, sizeof(u));
+	
+	p[0] = u;
+	p[1] = u >> 8;
+	p[2] = u >> 16;
+	p[3] = u >> 24;
+	return p+4;
+}
+
+static int ply_write_binary_vertices(uint8_t *buf, PointCloud &c, int first, int count) {
+	uint8_t *p = buf;
+	
+	for(int i = first; i < first+count; i++) {
+		p = put_float_le(p, c.coord(i, 0));
+		p = put_float_le(p, c.coord(i, 1));
+		p = put_float_le(p, c.coord(i, 2));
+		*p++ = c.rgb[3*i];
+		*p++ = c.rgb[3*i+1];
+		*p++ = c.rgb[3*i+2];
+	}
+	
+	return p-buf;
+}
+
+static int ply_write_ascii_vertices(uint8_t *buf, PointCloud &c, int first, int count) {
+	char *p = (char *)buf;
+	
+	for(int i = first; i < first+count; i++)
+		p += snprintf(p, PLY_ASCII_VERTEX_MAXSIZE, "%f %f %f %d %d %d\n", c.coord(i, 0), c.coord(i, 1), c.coord(i, 2),
+					  c.rgb[3*i], c.rgb[3*i+1], c.rgb[3*i+2]);
+	
+	return p-(char *)buf;
+}
+
+static int ply_write_binary_faces(uint8_t *buf, PointCloud &c, int first, int count) {
+	uint8_t *p = buf;
+	
+	for(int i = first; i < first+count; i++) {
+		*p++ = 3;
+		for(int k = 0; k < 3; k++)
+			p = put_uint32_le(p, c.faces[3*i+k]);
+	}
+	
+	return p-buf;
+}
+
+static int ply_write_ascii_faces(uint8_t *buf, PointCloud &c, int first, int count) {
+	char *p = (char *)buf;
+	
+	for(int i = first; i < first+count; i++)
+		p += snprintf(p, PLY_ASCII_FACE_MAXSIZE, "3 %d %d %d\n", c.faces[3*i], c.faces[3*i+1], c.faces[3*i+2]);
+	
+	return p-(char *)buf;
+}
+
+PlyStream::PlyStream(PointCloud &c, int format) : cloud(c) {
+	this->format = format;
+	
+	block = new uint8_t[PLY_BLOCK_VERTICES*PLY_ASCII_VERTEX_MAXSIZE];
+	
+	// the header is the first block.
+	headerlen = ply_header((char *)block, format == CLOUD_FORMAT_PLY_ASCII ? "ascii" : "binary_little_endian", c.num, c.numfaces);
+	blocklen = headerlen;
+	blockpos = 0;
+	next = 0;
+	nextface = 0;
+}
+
+PlyStream::~PlyStream() {
+	delete[] block;
+}
+
+long PlyStream::size(void) {
+	if(format == CLOUD_FORMAT_PLY_ASCII)
+		return -1;
+	
+	return headerlen + (long)cloud.num*PLY_BINARY_VERTEX_SIZE + (long)cloud.numfaces*PLY_BINARY_FACE_SIZE;
+}
+
+void PlyStream::fillBlock(void) {
+	if(next >= cloud.num) {
+		int n = cloud.numfaces-nextface < PLY_BLOCK_VERTICES ? cloud.numfaces-nextface : PLY_BLOCK_VERTICES;
+		
+		if(format == CLOUD_FORMAT_PLY_ASCII)
+			blocklen = ply_write_ascii_faces(block, cloud, nextface, n);
+		else
+			blocklen = ply_write_binary_faces(block, cloud, nextface, n);
+		
+		blockpos = 0;
+		nextface += n;
+		return;
+	}
+	
+	int n = cloud.num-next < PLY_BLOCK_VERTICES ? cloud.num-next : PLY_BLOCK_VERTICES;
+	
+	if(format == CLOUD_FORMAT_PLY_ASCII)
+		blocklen = ply_write_ascii_vertices(block, cloud, next, n);
+	else
+		blocklen = ply_write_binary_vertices(block, cloud, next, n);
+	
+	blockpos = 0;
+	next += n;
+}
+
+size_t PlyStream::read(void *dest, size_t len) {
+	size_t copied = 0;
+	
+	while(copied < len) {
+		if(blockpos == blocklen) {
+			if(next >= cloud.num && nextface >= cloud.numfaces)
+				break;
+			
+			fillBlock();
+		}
+		
+		size_t n = blocklen-blockpos;
+		if(n > len-copied)
+			n = len-copied;
+		
+		memcpy((uint8_t *)dest+copied, block+blockpos, n);
+		blockpos += n;
+		copied += n;
+	}
+	
+	return copied;
+}
+
+static inline uint32_t get_uint32_le(const uint8_t *p) {
+	return p[0] | p[1] << 8 | p[2] << 16 | (uint32_t)p[3] << 24;
+}
+
+static inline float get_float_le(const uint8_t *p) {
+	uint32_t u = get_uint32_le(p);
+	float v;
+	memcpy(&v, &u, sizeof(v));
+	return v;
+}
+
+static inline uint8_t *put_varint(uint8_t *p, int32_t v) {
+	uint32_t u = ((uint32_t)v << 1) ^ (uint32_t)(v >> 31); // zigzag
+	
+	while(u >= 0x80) {
+		*p++ = u | 0x80;
+		u >>= 7;
+	}
+	*p++ = u;
+	return p;
+}
+
+static inline const uint8_t *get_varint(const uint8_t *p, const uint8_t *end, int32_t *v) {
+	uint32_t u = 0;
+	int shift = 0;
+	
+	while(p < end && shift < 35) {
+		u |= (uint32_t)(*p & 0x7f) << shift;
+		shift += 7;
+		if(!(*p++ & 0x80)) {
+			*v = (int32_t)(u >> 1) ^ -(int32_t)(u & 1);
+			return p;
+		}
+	}
+	
+	return NULL;
+}
+
+CompressedStream::CompressedStream(PointCloud &c, float quantum) : cloud(c) {
+	this->quantum = quantum;
+	
+	for(int k = 0; k < 3; k++)
+		min[k] = c.num > 0 ? c.coord(0, k) : 0.f;
+	
+	for(int i = 1; i < c.num; i++) {
+		for(int k = 0; k < 3; k++) {
+			if(c.coord(i, k) < min[k])
+				min[k] = c.coord(i, k);
+		}
+	}
+	
+	uint8_t *p = header;
+	memcpy(p, "RGBC", 4);
+	p[4] = RGBC_VERSION;
+	p[5] = p[6] = p[7] = 0;
+	p = put_uint32_le(p+8, c.num);
+	p = put_float_le(p, min[0]);
+	p = put_float_le(p, min[1]);
+	p = put_float_le(p, min[2]);
+	put_float_le(p, quantum);
+	headerpos = 0;
+	
+	z_stream *s = new z_stream;
+	memset(s, 0, sizeof(z_stream));
+	deflateInit(s, 3); // higher levels cost twice the time for a few percent
+	zs = s;
+	
+	block = new uint8_t[PLY_BLOCK_VERTICES*3*5];
+	phase = 0;
+	next = 0;
+	prev[0] = prev[1] = prev[2] = 0;
+}
+
+CompressedStream::~CompressedStream() {
+	deflateEnd((z_stream *)zs);
+	delete (z_stream *)zs;
+	delete[] block;
+}
+
+long CompressedStream::size(void) {
+	return -1;
+}
+
+void CompressedStream::fillBlock(void) {
+	z_stream *s = (z_stream *)zs;
+	uint8_t *p = block;
+	int n = cloud.num-next < PLY_BLOCK_VERTICES ? cloud.num-next : PLY_BLOCK_VERTICES;
+	
+	if(phase == 0) {
+		float inv = 1.f/quantum;
+		
+		for(int i = next; i < next+n; i++) {
+			int32_t q[3] = {(int32_t)lrintf((cloud.coord(i, 0)-min[0])*inv),
+							(int32_t)lrintf((cloud.coord(i, 1)-min[1])*inv),
+							(int32_t)lrintf((cloud.coord(i, 2)-min[2])*inv)};
+			
+			for(int k = 0; k < 3; k++) {
+				p = put_varint(p, q[k]-prev[k]);
+				prev[k] = q[k];
+			}
+		}
+	} else {
+		const uint8_t *plane = cloud.rgb+phase-1; // every third byte
+		uint8_t last = next > 0 ? plane[3*(next-1)] : 0;
+		
+		for(int i = next; i < next+n; i++) {
+			*p++ = plane[3*i]-last;
+			last = plane[3*i];
+		}
+	}
+	
+	next += n;
+	if(next >= cloud.num) {
+		phase++;
+		next = 0;
+	}
+	
+	s->next_in = block;
+	s->avail_in = p-block;
+}
+
+size_t CompressedStream::read(void *dest, size_t len) {
+	z_stream *s = (z_stream *)zs;
+	size_t copied = 0;
+	
+	if(headerpos < RGBC_HEADER_SIZE) {
+		copied = RGBC_HEADER_SIZE-headerpos < (int)len ? RGBC_HEADER_SIZE-headerpos : len;
+		memcpy(dest, header+headerpos, copied);
+		headerpos += copied;
+	}
+	
+	while(copied < len && phase < 5) {
+		if(s->avail_in == 0 && phase < 4)
+			fillBlock();
+		
+		s->next_out = (Bytef *)dest+copied;
+		s->avail_out = len-copied;
+		
+		int rc = deflate(s, phase == 4 ? Z_FINISH : Z_NO_FLUSH);
+		copied = len-s->avail_out;
+		
+		if(rc == Z_STREAM_END) {
+			phase = 5;
+		} else if(rc != Z_OK && rc != Z_BUF_ERROR) {
+			printf("Compression Error: deflate failed (%d).\n", rc);
+			phase = 5;
+		}
+	}
+	
+	return copied;
+}
+
+CloudStream *open_cloud_stream(PointCloud &c, int format) {
+	if(format == CLOUD_FORMAT_COMPRESSED)
+		return new CompressedStream(c, 1.f); // clouds are in millimetres
+	
+	return new PlyStream(c, format);
+}
+
+const char *cloud_extension(int format) {
+	return format == CLOUD_FORMAT_COMPRESSED ? "rgbc" : "ply";
+}
+
+PointCloud *decode_cloud(FILE *f) {
+	uint8_t header[RGBC_HEADER_SIZE];
+	
+	if(fread(header, 1, RGBC_HEADER_SIZE, f) != RGBC_HEADER_SIZE || memcmp(header, "RGBC", 4) != 0) {
+		printf("Decode Error: Not a compressed cloud.\n");
+		return NULL;
+	}
+	
+	if(header[4] != RGBC_VERSION) {
+		printf("Decode Error: Unsupported version %d.\n", header[4]);
+		return NULL;
+	}
+	
+	uint32_t count = get_uint32_le(header+8);
+	float min[3] = {get_float_le(header+12), get_float_le(header+16), get_float_le(header+20)};
+	float quantum = get_float_le(header+24);
+	
+	// a corrupt count mustn't allocate gigabytes or overflow zlib's 32 bit
+	// avail_out. sensors give far fewer points.
+	if(count > RGBC_MAX_POINTS) {
+		printf("Decode Error: %u points is more than the %d supported.\n", count, RGBC_MAX_POINTS);
+		return NULL;
+	}
+	int num = count;
+	
+	// inflate the whole body. it can't be larger than 5 bytes per coordinate
+	// and 3 bytes of color per point.
+	size_t bodysize = (size_t)num*(3*5+3);
+	uint8_t *body = new uint8_t[bodysize > 0 ? bodysize : 1];
+	uint8_t in[1<<16];
+	
+	z_stream s;
+	memset(&s, 0, sizeof(s));
+	inflateInit(&s);
+	s.next_out = body;
+	s.avail_out = bodysize;
+	
+	int rc = Z_OK;
+	while(rc != Z_STREAM_END) {
+		if(s.avail_in == 0) {
+			s.avail_in = fread(in, 1, sizeof(in), f);
+			s.next_in = in;
+			if(s.avail_in == 0)
+				break;
+		}
+		
+		rc = inflate(&s, Z_NO_FLUSH);
+		if(rc != Z_OK && rc != Z_STREAM_END)
+			break;
+	}
+	
+	size_t bodylen = bodysize-s.avail_out;
+	inflateEnd(&s);
+	
+	if(rc != Z_STREAM_END) {
+		printf("Decode Error: Corrupt or truncated data.\n");
+		delete[] body;
+		return NULL;
+	}
+	
+	PointCloud *c = new PointCloud(num);
+	
+	const uint8_t *p = body, *end = body+bodylen;
+	int32_t q[3] = {0, 0, 0};
+	
+	for(int i = 0; i < num && p != NULL; i++) {
+		for(int k = 0; k < 3 && p != NULL; k++) {
+			int32_t d = 0;
+			p = get_varint(p, end, &d);
+			q[k] += d;
+			c->xyz[3*i+k] = min[k]+q[k]*quantum;
+		}
+	}
+	
+	if(p == NULL || end-p != 3*(ptrdiff_t)num) {
+		printf("Decode Error: Corrupt data.\n");
+		delete[] body;
+		delete c;
+		return NULL;
+	}
+	
+	for(int k = 0; k < 3; k++) {
+		uint8_t last = 0;
+		for(int i = 0; i < num; i++) {
+			last += *p++;
+			c->rgb[3*i+k] = last;
+		}
+	}
+	
+	delete[] body;
+	return c;
+}
+
+void export_cloud(char *filename, PointCloud &c, int format) {
+	FILE *f = fopen(filename, "wb");
+	
+	if(f == NULL) {
+		printf("Export Error: Couldn't open '%s' for writing: %s.\n", filename, strerror(errno));
+		return;
+	}
+	
+	CloudStream *stream = open_cloud_stream(c, format);
+	char buf[1<<16];
+	size_t n;
+	
+	while((n = stream->read(buf, sizeof(buf))) > 0)
+		fwrite(buf, 1, n, f);
+	
+	delete stream;
+	fclose(f);
+}
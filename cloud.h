@@ -0,0 +1,166 @@
+#ifndef CLOUD_H
+#define CLOUD_H
+
+#include <stdint.h>
+#include <cstddef>
+#include <cstdio>
+
+struct SensorPose;
+
+struct PointCloud {
+public:
+	// quantized clouds keep their positions as int16 millimetres, 9 instead
+	// of 15 bytes per point. that covers +-32 m, more than sensors see.
+	PointCloud(int num, bool quantized = false);
+	~PointCloud();
+	
+	// makes room for exactly num points. the points are lost.
+	void allocate(int num);
+	
+	// coordinate k (0: x, 1: y, 2: z) of point i in millimetres.
+	inline float coord(int i, int k) const {
+		return quantized ? xyz16[3*i+k] : xyz[3*i+k];
+	}
+	
+	inline void set(int i, float x, float y, float z) {
+		if(quantized) {
+			xyz16[3*i] = to_mm16(x);
+			xyz16[3*i+1] = to_mm16(y);
+			xyz16[3*i+2] = to_mm16(z);
+		} else {
+			xyz[3*i] = x;
+			xyz[3*i+1] = y;
+			xyz[3*i+2] = z;
+		}
+	}
+	
+	bool quantized;
+	float *xyz; // interleaved x, y, z, NULL if quantized
+	int16_t *xyz16; // the same rounded, NULL if not quantized
+	uint8_t *rgb; // interleaved r, g, b
+	
+	int num;
+	
+	int32_t *faces; // 3 point indices per triangle, NULL if not meshed
+	int numfaces;
+	
+	int refs; // see release_cloud
+	
+private:
+	static inline int16_t to_mm16(float v) {
+		if(v >= 32767.f)
+			return 32767;
+		if(v <= -32768.f)
+			return -32768;
+		return v < 0.f ? (int16_t)(v-.5f) : (int16_t)(v+.5f);
+	}
+};
+
+// merges all points within the same cube of voxelsize edge length into one
+// point with their average position and color. faces are moved to the merged
+// points, the ones that collapse are dropped.
+void voxel_downsample(PointCloud &c, float voxelsize);
+// one cloud with the points and faces of n clouds, one after the other.
+PointCloud *merge_clouds(PointCloud **clouds, int n);
+// a cloud starts out with one owner. clouds handed to several threads, which
+// must only read them from then on, get a reference per owner. the last
+// release deletes the cloud.
+void retain_cloud(PointCloud *c);
+void release_cloud(PointCloud *c);
+// moves the points of a sensor's cloud into the frame its pose is given in.
+void transform_cloud(PointCloud &c, const SensorPose &pose);
+
+enum {
+	PLY_BINARY_VERTEX_SIZE = 3*4+3, // packed float32 x, y, z and uint8 r, g, b
+	PLY_ASCII_VERTEX_MAXSIZE = 3*48+3*4+1, // "%f %f %f %d %d %d\n" worst case
+	PLY_BINARY_FACE_SIZE = 1+3*4, // uint8 3 and int32 indices
+	PLY_ASCII_FACE_MAXSIZE = 2+3*12+1, // "3 %d %d %d\n" worst case
+	PLY_BLOCK_VERTICES = 8192, // vertices or faces serialized at once
+	
+	RGBC_HEADER_SIZE = 28,
+	RGBC_VERSION = 1,
+	RGBC_MAX_POINTS = 1<<24 // decode_cloud rejects more, see there
+};
+
+// Serializes a point cloud in blocks, so it can be written or uploaded
+// without holding the whole file in memory.
+class CloudStream {
+public:
+	virtual ~CloudStream() {}
+	
+	// copies up to len bytes of the file to dest. returns 0 at the end.
+	virtual size_t read(void *dest, size_t len) = 0;
+	// total file size in bytes or -1 if it is not known in advance.
+	virtual long size(void) = 0;
+};
+
+class PlyStream : public CloudStream {
+public:
+	PlyStream(PointCloud &c, int format);
+	~PlyStream();
+	
+	size_t read(void *dest, size_t len);
+	long size(void);
+	
+private:
+	void fillBlock(void);
+	
+	PointCloud &cloud;
+	int format;
+	
+	uint8_t *block;
+	int headerlen;
+	int blocklen;
+	int blockpos;
+	int next; // next vertex to be serialized
+	int nextface; // and face, once all vertices are
+};
+
+// Compressed cloud format (.rgbc). All values little endian.
+//
+// header:  "RGBC", uint8 version, 3 bytes reserved, uint32 point count,
+//          float32 min x, y, z, float32 quantum
+// body:    zlib stream of
+//          - per point x, y, z each as round((v-min)/quantum), stored as the
+//            zigzag varint of the difference to the previous point's value
+//          - the red, green and blue planes, each byte as the difference to
+//            the previous point's value (mod 256)
+//
+// Points keep the order of the cloud, which for clouds from
+// depth_to_pointcloud is row-major and keeps the differences small. Faces
+// aren't stored.
+class CompressedStream : public CloudStream {
+public:
+	CompressedStream(PointCloud &c, float quantum);
+	~CompressedStream();
+	
+	size_t read(void *dest, size_t len);
+	long size(void);
+	
+private:
+	void fillBlock(void);
+	
+	PointCloud &cloud;
+	float quantum;
+	float min[3];
+	
+	uint8_t header[RGBC_HEADER_SIZE];
+	int headerpos;
+	
+	void *zs; // z_stream
+	uint8_t *block;
+	int phase; // 0: positions, 1-3: color planes, 4: finishing, 5: done
+	int next;
+	int32_t prev[3];
+};
+
+CloudStream *open_cloud_stream(PointCloud &c, int format);
+// file name extension for clouds of format, without the dot.
+const char *cloud_extension(int format);
+
+void export_cloud(char *filename, PointCloud &c, int format);
+
+// reads a compressed cloud. returns NULL on error.
+PointCloud *decode_cloud(FILE *f);
+
+#endif
\ No newline at end of file
@@ -3,6 +3,7 @@
 #include <cstdlib>
 #include <cerrno>
 #include <cmath>
+#include <unistd.h>
 
 #include "config.h"
 
@@ -16,26 +17,90 @@ void Config::setDefaults(void ) {
 	delete[] dest_url;
 	delete[] dest_username;
 	delete[] dest_password;
+	delete[] source_uri;
 	
 	dest_url = NULL;
 	dest_username = NULL;
 	dest_password = NULL;
+	dest_stream = 0;
+	dest_transfers = 4;
+	dest_retries = 5;
+	dest_retry_delay = 1000;
 	
+	capture_mode = CAPTURE_MODE_ONI;
 	capture_time = 2000;
 	crop_left = 0;
 	crop_right = 0;
 	crop_top = 0;
 	crop_bottom = 0;
 	capture_max_depth = INFINITY;
+	capture_voxel_size = 0.f;
+	capture_mesh_step = 0.f;
+	capture_quantize = 0;
+	capture_merge = 0;
+	capture_format = CLOUD_FORMAT_PLY_ASCII;
+	capture_threads = sysconf(_SC_NPROCESSORS_ONLN);
+	if(capture_threads < 1)
+		capture_threads = 1;
+	
+	source_type = SOURCE_TYPE_OPENNI;
+	source_uri = NULL;
+	source_count = 1;
+	source_width = 640;
+	source_height = 480;
+	source_fps = 30;
+	source_noise = 5.f;
+	source_invalid = .05f;
+	memset(source_pose, 0, sizeof(source_pose));
+	
+	thumb_scale = 2;
+	thumb_quality = 20;
+	thumb_cache_time = 500;
+	thumb_preview_fps = 5;
 	
 	daemon_port = 11222;
 	daemon_timeout = 3;
 }
 
+static char *copy_string(const char *s) {
+	if(s == NULL)
+		return NULL;
+	
+	char *d = new char[strlen(s)+1];
+	strcpy(d, s);
+	return d;
+}
+
+Config::Config(const Config &other) {
+	memset(this, 0, sizeof(Config));
+	
+	*this = other;
+}
+
+Config &Config::operator=(const Config &other) {
+	if(this == &other)
+		return *this;
+	
+	delete[] dest_url;
+	delete[] dest_username;
+	delete[] dest_password;
+	delete[] source_uri;
+	
+	memcpy(this, &other, sizeof(Config));
+	
+	dest_url = copy_string(other.dest_url);
+	dest_username = copy_string(other.dest_username);
+	dest_password = copy_string(other.dest_password);
+	source_uri = copy_string(other.source_uri);
+	
+	return *this;
+}
+
 Config::~Config() {
 	delete[] dest_url;
 	delete[] dest_username;
 	delete[] dest_password;
+	delete[] source_uri;
 }
 
 static void conf_strval(char *str, void *dest) {
@@ -56,6 +121,59 @@ static void conf_floatval(char *str, void *dest) {
 	*d = atof(str);
 }
 
+static void conf_formatval(char *str, void *dest) {
+	int *d = (int *)dest;
+	
+	if(strcmp(str, "ascii") == 0)
+		*d = CLOUD_FORMAT_PLY_ASCII;
+	else if(strcmp(str, "binary") == 0)
+		*d = CLOUD_FORMAT_PLY_BINARY;
+	else if(strcmp(str, "compressed") == 0)
+		*d = CLOUD_FORMAT_COMPRESSED;
+	else
+		printf("Config Warning: unknown format '%s'. Keeping previous setting.\n", str);
+}
+
+static void conf_modeval(char *str, void *dest) {
+	int *d = (int *)dest;
+	
+	if(strcmp(str, "oni") == 0)
+		*d = CAPTURE_MODE_ONI;
+	else if(strcmp(str, "direct") == 0)
+		*d = CAPTURE_MODE_DIRECT;
+	else
+		printf("Config Warning: unknown mode '%s'. Keeping previous setting.\n", str);
+}
+
+// "n x y z rx ry rz" sets the pose of sensor n.
+static void conf_poseval(char *str, void *dest) {
+	SensorPose *d = (SensorPose *)dest;
+	SensorPose pose;
+	int n;
+	
+	if(sscanf(str, "%d %f %f %f %f %f %f", &n, &pose.position[0], &pose.position[1], &pose.position[2],
+			  &pose.rotation[0], &pose.rotation[1], &pose.rotation[2]) != 7 || n < 0 || n >= CONF_MAX_SENSORS) {
+		printf("Config Warning: invalid pose '%s'. Keeping previous setting.\n", str);
+		return;
+	}
+	
+	pose.set = true;
+	d[n] = pose;
+}
+
+static void conf_sourceval(char *str, void *dest) {
+	int *d = (int *)dest;
+	
+	if(strcmp(str, "openni") == 0)
+		*d = SOURCE_TYPE_OPENNI;
+	else if(strcmp(str, "synthetic") == 0)
+		*d = SOURCE_TYPE_SYNTHETIC;
+	else if(strcmp(str, "file") == 0)
+		*d = SOURCE_TYPE_FILE;
+	else
+		printf("Config Warning: unknown source '%s'. Keeping previous setting.\n", str);
+}
+
 int Config::read(char *filename) {
 	char buf[512];
 	int buflen;
@@ -70,14 +188,40 @@ int Config::read(char *filename) {
 	} conf_section_destination[] = {
 		{"url", &this->dest_url, conf_strval},
 		{"username", &this->dest_username, conf_strval},
-		{"password", &this->dest_password, conf_strval}},
+		{"password", &this->dest_password, conf_strval},
+		{"stream", &this->dest_stream, conf_intval},
+		{"transfers", &this->dest_transfers, conf_intval},
+		{"retries", &this->dest_retries, conf_intval},
+		{"retry_delay", &this->dest_retry_delay, conf_intval}},
 	  conf_section_capture[] = {
+		{"mode", &this->capture_mode, conf_modeval},
 		{"capture_time", &this->capture_time, conf_intval},
 		{"crop_left", &this->crop_left, conf_intval},
 		{"crop_right", &this->crop_right, conf_intval},
 		{"crop_top", &this->crop_top, conf_intval},
 		{"crop_bottom", &this->crop_bottom, conf_intval},
-		{"max_depth", &this->capture_max_depth, conf_floatval}},
+		{"max_depth", &this->capture_max_depth, conf_floatval},
+		{"voxel_size", &this->capture_voxel_size, conf_floatval},
+		{"mesh_step", &this->capture_mesh_step, conf_floatval},
+		{"quantize", &this->capture_quantize, conf_intval},
+		{"merge", &this->capture_merge, conf_intval},
+		{"format", &this->capture_format, conf_formatval},
+		{"threads", &this->capture_threads, conf_intval}},
+	  conf_section_source[] = {
+		{"type", &this->source_type, conf_sourceval},
+		{"uri", &this->source_uri, conf_strval},
+		{"count", &this->source_count, conf_intval},
+		{"width", &this->source_width, conf_intval},
+		{"height", &this->source_height, conf_intval},
+		{"fps", &this->source_fps, conf_intval},
+		{"noise", &this->source_noise, conf_floatval},
+		{"invalid", &this->source_invalid, conf_floatval},
+		{"pose", this->source_pose, conf_poseval}},
+	  conf_section_thumbnail[] = {
+		{"scale", &this->thumb_scale, conf_intval},
+		{"quality", &this->thumb_quality, conf_intval},
+		{"cache_time", &this->thumb_cache_time, conf_intval},
+		{"preview_fps", &this->thumb_preview_fps, conf_intval}},
 	  conf_section_daemon[] = {
 		{"port", &this->daemon_port, conf_intval},
 		{"timeout", &this->daemon_timeout, conf_intval}
@@ -90,6 +234,8 @@ int Config::read(char *filename) {
 	} conf_sections[] = {
 		{"Destination", conf_section_destination, sizeof(conf_section_destination)/sizeof(ConfigKeyword)},
 		{"Capture", conf_section_capture, sizeof(conf_section_capture)/sizeof(ConfigKeyword)},
+		{"Source", conf_section_source, sizeof(conf_section_source)/sizeof(ConfigKeyword)},
+		{"Thumbnail", conf_section_thumbnail, sizeof(conf_section_thumbnail)/sizeof(ConfigKeyword)},
 		{"Daemon", conf_section_daemon, sizeof(conf_section_daemon)/sizeof(ConfigKeyword)}
 	};
 		
@@ -114,6 +260,7 @@ nextline: while(fgets(buf, sizeof(buf), cfgfile)) {
 		if(buf[0] == '[') {
 			if(buf[buflen-1] != ']') {
 				printf("Config Error: line %d: illegal section declaration. Missing ']'.\n", line);
+				fclose(cfgfile);
 				return 0;
 			}
 				
@@ -126,6 +273,7 @@ nextline: while(fgets(buf, sizeof(buf), cfgfile)) {
 			}
 			
 			printf("Config Error: line %d: section does not exist.\n", line);
+			fclose(cfgfile);
 			return 0;
 		}
 		
@@ -135,11 +283,13 @@ nextline: while(fgets(buf, sizeof(buf), cfgfile)) {
 		
 		if(*p != ' ' || (*p != '\0' && *(p+1) == '\0')) {
 			printf("Config Error: line %d: expected value after key.\n", line);
+			fclose(cfgfile);
 			return 0;
 		}
 		
 		if(current_section == -1) {
 			printf("Config Error: line %d: keyword without section detected.\n", line);
+			fclose(cfgfile);
 			return 0;
 		}
 		
@@ -151,12 +301,19 @@ nextline: while(fgets(buf, sizeof(buf), cfgfile)) {
 		}
 		
 		printf("Config Error: line %d: illegal keyword detected.\n", line);
+		fclose(cfgfile);
 		return 0;
 	}
 	
 		
 	fclose(cfgfile);
 	
+	// the faces would be computed for nothing.
+	if(this->capture_mesh_step > 0.f && this->capture_format == CLOUD_FORMAT_COMPRESSED) {
+		printf("Config Warning: The compressed format has no faces. Ignoring mesh_step.\n");
+		this->capture_mesh_step = 0.f;
+	}
+	
 	printf("Successfully read '%s'\n", filename);
 	
 	return 1;
@@ -3,27 +3,81 @@
 
 enum {
 	CONF_MAX_KEY_LEN = 64,
-	CONF_MAX_SECTION_LEN = 64
+	CONF_MAX_SECTION_LEN = 64,
+	CONF_MAX_SENSORS = 16 // sensors that can have a pose
+};
+
+enum CloudFormat {
+	CLOUD_FORMAT_PLY_ASCII,
+	CLOUD_FORMAT_PLY_BINARY,
+	CLOUD_FORMAT_COMPRESSED
+};
+
+enum CaptureMode {
+	CAPTURE_MODE_ONI,
+	CAPTURE_MODE_DIRECT
+};
+
+enum SourceType {
+	SOURCE_TYPE_OPENNI,
+	SOURCE_TYPE_SYNTHETIC,
+	SOURCE_TYPE_FILE
+};
+
+// Where a sensor is in the frame clouds of several sensors are merged into.
+struct SensorPose {
+	bool set;
+	float position[3]; // meters
+	float rotation[3]; // degrees about x, y and z, applied in that order
 };
 
 class Config {
 public:
 	Config();
+	Config(const Config &other);
 	~Config();
 	
+	Config &operator=(const Config &other);
+	
 	void setDefaults(void);
 	int read(char *filename);
 	
 	char *dest_url;
 	char *dest_username;
 	char *dest_password;
+	int dest_stream;
+	int dest_transfers;
+	int dest_retries;
+	int dest_retry_delay;
 	
+	int capture_mode;
 	int capture_time;
 	float capture_max_depth;
+	float capture_voxel_size;
+	float capture_mesh_step;
+	int capture_quantize;
+	int capture_merge;
 	int crop_left;
 	int crop_right;
 	int crop_top;
 	int crop_bottom;
+	int capture_format;
+	int capture_threads;
+	
+	int source_type;
+	char *source_uri;
+	int source_count;
+	int source_width;
+	int source_height;
+	int source_fps;
+	float source_noise;
+	float source_invalid;
+	SensorPose source_pose[CONF_MAX_SENSORS];
+	
+	int thumb_scale;
+	int thumb_quality;
+	int thumb_cache_time;
+	int thumb_preview_fps;
 	
 	int daemon_port;
 	int daemon_timeout;
@@ -0,0 +1,472 @@
+#include <cstdio>
+#include <cstring>
+#include <cerrno>
+#include <unistd.h>
+
+#include "framesource.h"
+#include "synthetic.h"
+#include "capture.h"
+#include "config.h"
+
+static long long now_us(void) {
+	struct timespec tp;
+	clock_gettime(CLOCK_MONOTONIC, &tp);
+	return tp.tv_sec*1000000LL+tp.tv_nsec/1000;
+}
+
+static int stream_index(int stream) {
+	return stream == SOURCE_DEPTH ? 0 : 1;
+}
+
+bool FrameSource::recordOni(const char *filename, int ms) {
+	printf("Error: Only OpenNI devices can record ONI files.\n");
+	return false;
+}
+
+bool FrameSource::setCropping(Config &conf) {
+	printf("Error: The cropping of this source can't be changed.\n");
+	return false;
+}
+
+FramePacer::FramePacer() {
+	due[0] = due[1] = 0;
+	interval = 0;
+	last = SOURCE_COLOR;
+}
+
+void FramePacer::setup(int fps) {
+	interval = fps > 0 ? 1000000/fps : 0;
+}
+
+void FramePacer::restart(int stream) {
+	due[stream_index(stream)] = now_us();
+}
+
+int FramePacer::next(int streams) {
+	if(streams != (SOURCE_DEPTH | SOURCE_COLOR))
+		return streams;
+	
+	// alternate if both are due at the same time. unpaced streams always
+	// are, whenever they were restarted.
+	if(interval == 0 || due[0] == due[1])
+		return last = (last == SOURCE_DEPTH ? SOURCE_COLOR : SOURCE_DEPTH);
+	
+	return last = (due[0] < due[1] ? SOURCE_DEPTH : SOURCE_COLOR);
+}
+
+bool FramePacer::wait(int stream, int timeoutms) {
+	long long &d = due[stream_index(stream)];
+	long long now = now_us();
+	
+	if(interval == 0)
+		return true;
+	
+	if(d-now > timeoutms*1000LL) {
+		usleep(timeoutms*1000);
+		return false;
+	}
+	
+	if(d > now)
+		usleep(d-now);
+	
+	// don't catch up on frames a slow reader missed
+	d = (d > now ? d : now)+interval;
+	return true;
+}
+
+void crop_window(Config &conf, int w, int h, int *x, int *y, int *cw, int *ch) {
+	int cl = w*conf.crop_left/100;
+	int cr = w*conf.crop_right/100;
+	int ct = h*conf.crop_top/100;
+	int cb = h*conf.crop_bottom/100;
+	
+	*x = cl;
+	*y = ct;
+	*cw = w-cl-cr;
+	*ch = h-ct-cb;
+}
+
+SyntheticSource::SyntheticSource(Config &conf, int seed) {
+	int w = conf.source_width, h = conf.source_height;
+	
+	scene = new SyntheticScene(w, h, conf.source_noise, conf.source_invalid, seed);
+	
+	sinfo.resx = w;
+	sinfo.resy = h;
+	sinfo.hfov = scene->hfov;
+	sinfo.vfov = scene->vfov;
+	sinfo.fps = conf.source_fps;
+	
+	pacer.setup(conf.source_fps);
+	running = 0;
+	
+	full = new uint16_t[w*h];
+	depth = NULL;
+	color = NULL;
+	setCropping(conf);
+	
+	printf("Synthetic source: %dx%d at %d fps, %.1f mm noise, %.1f%% invalid\n",
+		   w, h, conf.source_fps, conf.source_noise, conf.source_invalid*100.f);
+}
+
+SyntheticSource::~SyntheticSource() {
+	delete scene;
+	delete[] full;
+	delete[] depth;
+	delete[] color;
+}
+
+void SyntheticSource::start(int streams) {
+	if(streams & ~running & SOURCE_DEPTH)
+		pacer.restart(SOURCE_DEPTH);
+	if(streams & ~running & SOURCE_COLOR)
+		pacer.restart(SOURCE_COLOR);
+	
+	running |= streams;
+}
+
+void SyntheticSource::stop(int streams) {
+	running &= ~streams;
+}
+
+int SyntheticSource::read(Frame *frame, int streams, int timeoutms) {
+	streams &= running;
+	if(streams == 0)
+		return 0;
+	
+	int stream = pacer.next(streams);
+	if(!pacer.wait(stream, timeoutms))
+		return 0;
+	
+	frame->stream = stream;
+	frame->width = sinfo.cropw;
+	frame->height = sinfo.croph;
+	
+	if(stream == SOURCE_DEPTH) {
+		scene->depth(full);
+		for(int y = 0; y < sinfo.croph; y++)
+			memcpy(depth+y*sinfo.cropw, full+(y+sinfo.cropy)*sinfo.resx+sinfo.cropx, 2*sinfo.cropw);
+		frame->data = depth;
+	} else {
+		frame->data = color;
+	}
+	
+	return 1;
+}
+
+StreamInfo SyntheticSource::info(int stream) {
+	return sinfo;
+}
+
+bool SyntheticSource::setCropping(Config &conf) {
+	int w = sinfo.resx, h = sinfo.resy;
+	
+	crop_window(conf, w, h, &sinfo.cropx, &sinfo.cropy, &sinfo.cropw, &sinfo.croph);
+	
+	delete[] depth;
+	delete[] color;
+	depth = new uint16_t[sinfo.cropw*sinfo.croph];
+	color = new uint8_t[3*sinfo.cropw*sinfo.croph];
+	
+	uint8_t *fullcolor = new uint8_t[3*w*h];
+	scene->color(fullcolor);
+	for(int y = 0; y < sinfo.croph; y++)
+		memcpy(color+3*y*sinfo.cropw, fullcolor+3*((y+sinfo.cropy)*w+sinfo.cropx), 3*sinfo.cropw);
+	delete[] fullcolor;
+	
+	return true;
+}
+
+FileSource::FileSource() {
+	file = NULL;
+	dataoffset = 0;
+	running = 0;
+	pending = 0;
+	
+	for(int i = 0; i < 2; i++) {
+		buf[i] = NULL;
+		bufsize[i] = 0;
+	}
+}
+
+FileSource::~FileSource() {
+	if(file != NULL)
+		fclose(file);
+	
+	for(int i = 0; i < 2; i++)
+		delete[] (char *)buf[i];
+}
+
+static bool read_info(FILE *f, StreamInfo *s) {
+	int32_t v[7];
+	float fov[2];
+	
+	if(fread(v, sizeof(v), 1, f) != 1 || fread(fov, sizeof(fov), 1, f) != 1)
+		return false;
+	
+	s->resx = v[0];
+	s->resy = v[1];
+	s->cropx = v[2];
+	s->cropy = v[3];
+	s->cropw = v[4];
+	s->croph = v[5];
+	s->fps = v[6];
+	s->hfov = fov[0];
+	s->vfov = fov[1];
+	
+	return s->cropw > 0 && s->croph > 0 && s->cropw <= 1<<14 && s->croph <= 1<<14;
+}
+
+bool FileSource::open(const char *filename, Config &conf) {
+	char magic[4];
+	uint32_t version;
+	
+	if(filename == NULL) {
+		printf("Error: The file source needs a uri.\n");
+		return false;
+	}
+	
+	file = fopen(filename, "rb");
+	if(file == NULL) {
+		printf("Error: Couldn't open '%s': %s\n", filename, strerror(errno));
+		return false;
+	}
+	
+	if(fread(magic, 4, 1, file) != 1 || memcmp(magic, "RGBF", 4) != 0
+		|| fread(&version, 4, 1, file) != 1 || version != 1
+		|| !read_info(file, &sinfo[0]) || !read_info(file, &sinfo[1])) {
+		printf("Error: '%s' isn't a frame recording.\n", filename);
+		return false;
+	}
+	
+	dataoffset = ftell(file);
+	
+	bufsize[0] = 2*sinfo[0].cropw*sinfo[0].croph;
+	bufsize[1] = 3*sinfo[1].cropw*sinfo[1].croph;
+	for(int i = 0; i < 2; i++)
+		buf[i] = new char[bufsize[i]];
+	
+	// at the recorded rate. fps 0 replays as fast as possible.
+	pacer.setup(conf.source_fps > 0 ? sinfo[0].fps : 0);
+	
+	printf("Replaying '%s': depth %dx%d, color %dx%d\n", filename,
+		   sinfo[0].cropw, sinfo[0].croph, sinfo[1].cropw, sinfo[1].croph);
+	
+	return true;
+}
+
+void FileSource::start(int streams) {
+	if(streams & ~running & SOURCE_DEPTH)
+		pacer.restart(SOURCE_DEPTH);
+	if(streams & ~running & SOURCE_COLOR)
+		pacer.restart(SOURCE_COLOR);
+	
+	running |= streams;
+}
+
+void FileSource::stop(int streams) {
+	running &= ~streams;
+	
+	if(pending & streams)
+		pending = 0;
+}
+
+// reads the next record of a stream in the mask into its buffer. starts
+// over at the end of the file.
+bool FileSource::readRecord(int streams) {
+	bool rewound = false;
+	uint32_t head[2];
+	uint64_t stamp;
+	
+	while(1) {
+		if(fread(head, sizeof(head), 1, file) != 1 || fread(&stamp, sizeof(stamp), 1, file) != 1) {
+			if(rewound) // no frame of these streams in the whole file
+				return false;
+			
+			fseek(file, dataoffset, SEEK_SET);
+			rewound = true;
+			continue;
+		}
+		
+		int stream = head[0];
+		int i = stream_index(stream);
+		
+		if((stream != SOURCE_DEPTH && stream != SOURCE_COLOR) || (int)head[1] != bufsize[i]) {
+			printf("Error: Corrupt frame recording.\n");
+			return false;
+		}
+		
+		if(!(stream & streams)) {
+			fseek(file, head[1], SEEK_CUR);
+			continue;
+		}
+		
+		if(fread(buf[i], bufsize[i], 1, file) != 1)
+			continue; // truncated, start over
+		
+		pending = stream;
+		return true;
+	}
+}
+
+int FileSource::read(Frame *frame, int streams, int timeoutms) {
+	streams &= running;
+	if(streams == 0)
+		return 0;
+	
+	if(!(pending & streams) && !readRecord(streams))
+		return 0;
+	
+	if(!pacer.wait(pending, timeoutms))
+		return 0;
+	
+	int i = stream_index(pending);
+	frame->stream = pending;
+	frame->width = sinfo[i].cropw;
+	frame->height = sinfo[i].croph;
+	frame->data = buf[i];
+	pending = 0;
+	
+	return 1;
+}
+
+StreamInfo FileSource::info(int stream) {
+	return sinfo[stream_index(stream)];
+}
+
+FrameWriter::FrameWriter() {
+	file = NULL;
+	started = false;
+}
+
+FrameWriter::~FrameWriter() {
+	close();
+}
+
+static void write_info(FILE *f, StreamInfo &s) {
+	int32_t v[7] = {s.resx, s.resy, s.cropx, s.cropy, s.cropw, s.croph, s.fps};
+	float fov[2] = {s.hfov, s.vfov};
+	
+	fwrite(v, sizeof(v), 1, f);
+	fwrite(fov, sizeof(fov), 1, f);
+}
+
+bool FrameWriter::open(const char *filename, StreamInfo &depth, StreamInfo &color) {
+	uint32_t version = 1;
+	
+	file = fopen(filename, "wb");
+	if(file == NULL) {
+		printf("Error: Couldn't open '%s' for writing: %s\n", filename, strerror(errno));
+		return false;
+	}
+	
+	fwrite("RGBF", 4, 1, file);
+	fwrite(&version, 4, 1, file);
+	write_info(file, depth);
+	write_info(file, color);
+	started = false;
+	
+	return !ferror(file);
+}
+
+bool FrameWriter::write(Frame &frame) {
+	if(!started) {
+		clock_gettime(CLOCK_MONOTONIC, &start);
+		started = true;
+	}
+	
+	struct timespec tp;
+	clock_gettime(CLOCK_MONOTONIC, &tp);
+	
+	uint32_t head[2] = {(uint32_t)frame.stream, (uint32_t)(frame.width*frame.height*(frame.stream == SOURCE_DEPTH ? 2 : 3))};
+	uint64_t stamp = (tp.tv_sec-start.tv_sec)*1000000LL+(tp.tv_nsec-start.tv_nsec)/1000;
+	
+	fwrite(head, sizeof(head), 1, file);
+	fwrite(&stamp, sizeof(stamp), 1, file);
+	fwrite(frame.data, head[1], 1, file);
+	
+	return !ferror(file);
+}
+
+void FrameWriter::close(void) {
+	if(file != NULL)
+		fclose(file);
+	file = NULL;
+}
+
+FrameSource *open_frame_source(Config &conf) {
+	if(conf.source_type == SOURCE_TYPE_SYNTHETIC)
+		return new SyntheticSource(conf);
+	
+	if(conf.source_type == SOURCE_TYPE_FILE) {
+		FileSource *source = new FileSource;
+		if(!source->open(conf.source_uri, conf)) {
+			delete source;
+			return NULL;
+		}
+		return source;
+	}
+	
+	OpenNISource *source = new OpenNISource;
+	if(!source->open(conf.source_uri, &conf)) {
+		delete source;
+		return NULL;
+	}
+	return source;
+}
+
+bool open_frame_sources(Config &conf, std::vector<FrameSource *> &sources) {
+	const char *uri = conf.source_uri;
+	
+	if(conf.source_type == SOURCE_TYPE_SYNTHETIC) {
+		for(int i = 0; i < (conf.source_count > 1 ? conf.source_count : 1); i++)
+			sources.push_back(new SyntheticSource(conf, i+1));
+		return true;
+	}
+	
+	if(conf.source_type != SOURCE_TYPE_OPENNI || uri == NULL || (strcmp(uri, "all") != 0 && strchr(uri, ',') == NULL)) {
+		FrameSource *source = open_frame_source(conf);
+		if(source == NULL)
+			return false;
+		sources.push_back(source);
+		return true;
+	}
+	
+	std::vector<std::string> uris;
+	if(strcmp(uri, "all") == 0) {
+		if(!openni_device_uris(uris))
+			return false;
+		
+		if(uris.empty()) {
+			printf("OpenNI: No devices found.\n");
+			return false;
+		}
+	} else {
+		const char *p = uri;
+		while(*p) {
+			while(*p == ' ')
+				p++;
+			
+			const char *end = strchr(p, ',');
+			if(end == NULL)
+				end = p+strlen(p);
+			if(end > p)
+				uris.push_back(std::string(p, end-p));
+			
+			p = *end ? end+1 : end;
+		}
+	}
+	
+	for(size_t i = 0; i < uris.size(); i++) {
+		printf("Opening device %d: %s\n", (int)i, uris[i].c_str());
+		
+		OpenNISource *source = new OpenNISource;
+		if(!source->open(uris[i].c_str(), &conf)) {
+			delete source;
+			return false;
+		}
+		sources.push_back(source);
+	}
+	
+	return true;
+}
@@ -0,0 +1,152 @@
+#ifndef FRAMESOURCE_H
+#define FRAMESOURCE_H
+
+#include <cstdio>
+#include <ctime>
+#include <stdint.h>
+#include <vector>
+
+class Config;
+class SyntheticScene;
+
+enum {
+	SOURCE_DEPTH = 1,
+	SOURCE_COLOR = 2
+};
+
+struct StreamInfo {
+	int resx, resy; // full resolution
+	int cropx, cropy, cropw, croph; // frames are cropw x croph
+	float hfov, vfov; // radians
+	int fps;
+};
+
+struct Frame {
+	int stream; // SOURCE_DEPTH or SOURCE_COLOR
+	int width;
+	int height;
+	const void *data; // depth in millimetres or packed rgb. valid until the
+					  // next read
+};
+
+// Delivers the depth and color frames for captures and thumbnails, so they
+// work the same on a sensor, generated frames and recorded frames.
+class FrameSource {
+public:
+	virtual ~FrameSource() {}
+	
+	// streams is a mask of SOURCE_DEPTH and SOURCE_COLOR.
+	virtual void start(int streams) = 0;
+	virtual void stop(int streams) = 0;
+	// waits at most timeoutms for a frame of one of the running streams in
+	// the mask. returns 0 on timeout or at the end of a recording.
+	virtual int read(Frame *frame, int streams, int timeoutms) = 0;
+	virtual StreamInfo info(int stream) = 0;
+	
+	// records the running sensor to an ONI file for ms milliseconds. only
+	// OpenNI devices can.
+	virtual bool recordOni(const char *filename, int ms);
+	// applies the crop_* settings of conf, also to running streams. returns
+	// false if the source can't.
+	virtual bool setCropping(Config &conf);
+};
+
+// Spaces the frames of each stream 1/fps apart. fps 0 doesn't wait at all.
+class FramePacer {
+public:
+	FramePacer();
+	
+	void setup(int fps);
+	void restart(int stream);
+	// returns the stream out of the mask whose frame is due next.
+	int next(int streams);
+	// waits until the frame of stream is due. returns false after timeoutms
+	// if it isn't due by then.
+	bool wait(int stream, int timeoutms);
+
+private:
+	long long due[2]; // us, CLOCK_MONOTONIC
+	long long interval;
+	int last;
+};
+
+// Generated frames of a SyntheticScene, cropped like the sensor would.
+// Sources with different seeds have different noise.
+class SyntheticSource : public FrameSource {
+public:
+	SyntheticSource(Config &conf, int seed = 1);
+	~SyntheticSource();
+	
+	void start(int streams);
+	void stop(int streams);
+	int read(Frame *frame, int streams, int timeoutms);
+	StreamInfo info(int stream);
+	bool setCropping(Config &conf);
+
+private:
+	SyntheticScene *scene;
+	StreamInfo sinfo;
+	FramePacer pacer;
+	int running;
+	
+	uint16_t *full; // uncropped depth
+	uint16_t *depth;
+	uint8_t *color; // the scene doesn't move, so it's generated once
+};
+
+// Replays frames recorded with FrameWriter, from the start again at the end.
+class FileSource : public FrameSource {
+public:
+	FileSource();
+	~FileSource();
+	
+	bool open(const char *filename, Config &conf);
+	void start(int streams);
+	void stop(int streams);
+	int read(Frame *frame, int streams, int timeoutms);
+	StreamInfo info(int stream);
+
+private:
+	bool readRecord(int streams);
+	
+	FILE *file;
+	long dataoffset;
+	StreamInfo sinfo[2];
+	FramePacer pacer;
+	int running;
+	
+	int pending; // stream of the record in buf, 0 if none
+	void *buf[2];
+	int bufsize[2];
+};
+
+// Writes frames to a file for FileSource. All integers are little endian.
+// header: "RGBF", uint32 version, for depth and color: int32 resx, resy,
+//         cropx, cropy, cropw, croph, fps, float32 hfov, vfov
+// records: uint32 stream, uint32 size, uint64 microseconds since the first
+//          frame, size bytes of frame data
+class FrameWriter {
+public:
+	FrameWriter();
+	~FrameWriter();
+	
+	bool open(const char *filename, StreamInfo &depth, StreamInfo &color);
+	bool write(Frame &frame);
+	void close(void);
+
+private:
+	FILE *file;
+	struct timespec start;
+	bool started;
+};
+
+// the crop window the crop_* percentages of conf give for a w x h stream.
+void crop_window(Config &conf, int w, int h, int *x, int *y, int *cw, int *ch);
+// opens the source the config selects. returns NULL on failure.
+FrameSource *open_frame_source(Config &conf);
+// opens all sensors the config selects, see the uri option, or count
+// synthetic sources. returns false on failure. the sources opened until then
+// are left in sources.
+bool open_frame_sources(Config &conf, std::vector<FrameSource *> &sources);
+
+#endif
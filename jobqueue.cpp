@@ -0,0 +1,187 @@
+#include <stdint.h>
+#include <unistd.h>
+#include <ctime>
+#include <cerrno>
+#include <sys/eventfd.h>
+
+#include "jobqueue.h"
+#include "capture.h"
+#include "cloud.h"
+
+JobQueue::JobQueue() {
+	closed = false;
+	
+	pthread_mutex_init(&lock, NULL);
+	pthread_cond_init(&cond, NULL);
+}
+
+JobQueue::~JobQueue() {
+	pthread_cond_destroy(&cond);
+	pthread_mutex_destroy(&lock);
+}
+
+void JobQueue::push(const CaptureJob &job) {
+	pthread_mutex_lock(&lock);
+	jobs.push(job);
+	pthread_cond_signal(&cond);
+	pthread_mutex_unlock(&lock);
+}
+
+bool JobQueue::pop(CaptureJob *job) {
+	pthread_mutex_lock(&lock);
+	
+	while(jobs.empty() && !closed)
+		pthread_cond_wait(&cond, &lock);
+	
+	if(jobs.empty()) {
+		pthread_mutex_unlock(&lock);
+		return false;
+	}
+	
+	*job = jobs.front();
+	jobs.pop();
+	
+	pthread_mutex_unlock(&lock);
+	return true;
+}
+
+void JobQueue::close(void) {
+	pthread_mutex_lock(&lock);
+	closed = true;
+	pthread_cond_broadcast(&cond);
+	pthread_mutex_unlock(&lock);
+}
+
+int JobQueue::size(void) {
+	pthread_mutex_lock(&lock);
+	int n = jobs.size();
+	pthread_mutex_unlock(&lock);
+	
+	return n;
+}
+
+FramePool::FramePool(int size) {
+	this->size = size;
+	allocated = 0;
+	
+	pthread_mutex_init(&lock, NULL);
+	pthread_cond_init(&cond, NULL);
+}
+
+FramePool::~FramePool() {
+	for(size_t i = 0; i < free.size(); i++)
+		delete free[i];
+	
+	pthread_cond_destroy(&cond);
+	pthread_mutex_destroy(&lock);
+}
+
+CaptureFrames *FramePool::take(int timeoutms) {
+	struct timespec until;
+	clock_gettime(CLOCK_REALTIME, &until);
+	until.tv_sec += timeoutms/1000;
+	until.tv_nsec += (timeoutms%1000)*1000000L;
+	if(until.tv_nsec >= 1000000000L) {
+		until.tv_sec++;
+		until.tv_nsec -= 1000000000L;
+	}
+	
+	pthread_mutex_lock(&lock);
+	
+	int rc = 0;
+	while(free.empty() && allocated == size && rc != ETIMEDOUT)
+		rc = pthread_cond_timedwait(&cond, &lock, &until);
+	
+	CaptureFrames *frames = NULL;
+	if(!free.empty()) {
+		frames = free.back();
+		free.pop_back();
+	} else if(allocated < size) {
+		frames = new CaptureFrames;
+		allocated++;
+	}
+	
+	pthread_mutex_unlock(&lock);
+	return frames;
+}
+
+void FramePool::give(CaptureFrames *frames) {
+	pthread_mutex_lock(&lock);
+	
+	while(frames != NULL) {
+		CaptureFrames *next = frames->next;
+		frames->next = NULL;
+		free.push_back(frames);
+		pthread_cond_signal(&cond);
+		frames = next;
+	}
+	
+	pthread_mutex_unlock(&lock);
+}
+
+CloudMailbox::CloudMailbox() {
+	newest = -1;
+	arrived = 0;
+	parts = 0;
+	efd = eventfd(0, EFD_NONBLOCK | EFD_CLOEXEC);
+	
+	pthread_mutex_init(&lock, NULL);
+}
+
+CloudMailbox::~CloudMailbox() {
+	for(size_t i = 0; i < clouds.size(); i++)
+		release_cloud(clouds[i]);
+	close(efd);
+	pthread_mutex_destroy(&lock);
+}
+
+void CloudMailbox::put(PointCloud *c, int capture, int parts) {
+	pthread_mutex_lock(&lock);
+	if(capture < newest) {
+		pthread_mutex_unlock(&lock);
+		release_cloud(c);
+		return;
+	}
+	
+	if(capture > newest) {
+		for(size_t i = 0; i < clouds.size(); i++)
+			release_cloud(clouds[i]);
+		clouds.clear();
+		newest = capture;
+		arrived = 0;
+		this->parts = parts;
+	}
+	
+	if(c != NULL)
+		clouds.push_back(c);
+	arrived++;
+	bool complete = arrived == this->parts && !clouds.empty();
+	pthread_mutex_unlock(&lock);
+	
+	if(!complete)
+		return;
+	
+	uint64_t one = 1;
+	if(write(efd, &one, sizeof(one)) != sizeof(one))
+		return;
+}
+
+bool CloudMailbox::take(std::vector<PointCloud *> &out) {
+	uint64_t n;
+	if(read(efd, &n, sizeof(n)) != sizeof(n))
+		n = 0;
+	
+	pthread_mutex_lock(&lock);
+	bool complete = arrived == parts && !clouds.empty();
+	if(complete) {
+		out.insert(out.end(), clouds.begin(), clouds.end());
+		clouds.clear();
+	}
+	pthread_mutex_unlock(&lock);
+	
+	return complete;
+}
+
+int CloudMailbox::fd(void) {
+	return efd;
+}
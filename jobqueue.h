@@ -0,0 +1,95 @@
+#ifndef JOBQUEUE_H
+#define JOBQUEUE_H
+
+#include <pthread.h>
+#include <queue>
+#include <vector>
+
+struct PointCloud;
+struct CaptureFrames;
+
+struct CaptureJob {
+	char *filename;
+	// frames of a direct capture to convert, or NULL if filename is an ONI.
+	// several sensors' frames in a list give one merged cloud.
+	CaptureFrames *frames;
+	int capture; // counts up with every capture
+	int parts; // jobs the capture was queued as, one per sensor unless merged
+};
+
+// Thread safe queue of captures waiting to be processed.
+class JobQueue {
+public:
+	JobQueue();
+	~JobQueue();
+	
+	void push(const CaptureJob &job);
+	// blocks until a job is available. returns false if the queue was closed
+	// and all jobs are done.
+	bool pop(CaptureJob *job);
+	void close(void);
+	int size(void);
+	
+private:
+	std::queue<CaptureJob> jobs;
+	bool closed;
+	
+	pthread_mutex_t lock;
+	pthread_cond_t cond;
+};
+
+// Frames for direct captures, handed back by the worker once they are
+// converted, so the accumulation buffers of one capture are reused by the
+// next. At most size of them exist, which bounds the memory held by captures
+// waiting to be converted. They are only allocated when first needed.
+class FramePool {
+public:
+	FramePool(int size);
+	~FramePool();
+	
+	// waits at most timeoutms for frames to become free. returns NULL if
+	// none did.
+	CaptureFrames *take(int timeoutms);
+	// gives back frames and every other sensor's frames in their list.
+	void give(CaptureFrames *frames);
+	
+private:
+	std::vector<CaptureFrames *> free;
+	int size;
+	int allocated;
+	
+	pthread_mutex_t lock;
+	pthread_cond_t cond;
+};
+
+// Holds the clouds of the newest capture, one per sensor unless they were
+// merged, until the daemon sends them to the client. fd() becomes readable
+// whenever all clouds of a capture arrived.
+class CloudMailbox {
+public:
+	CloudMailbox();
+	~CloudMailbox();
+	
+	// takes over a reference to a cloud of capture, which was queued as parts jobs.
+	// NULL stands for a job that failed. clouds of an older capture that
+	// weren't taken are dropped. a cloud of an older capture than the newest
+	// one put is dropped instead, so clouds that finish out of order don't
+	// go back in time.
+	void put(PointCloud *cloud, int capture, int parts);
+	// moves the clouds of the newest capture into clouds, in the order they
+	// were put, once all of them arrived. returns false if there are none.
+	// the caller releases them.
+	bool take(std::vector<PointCloud *> &clouds);
+	int fd(void);
+	
+private:
+	std::vector<PointCloud *> clouds;
+	int newest; // capture of the last cloud put, -1 before the first
+	int arrived; // clouds of newest put so far, failed ones included
+	int parts;
+	int efd;
+	
+	pthread_mutex_t lock;
+};
+
+#endif
@@ -2,7 +2,12 @@
 #include <cstring>
 #include <cstdlib>
 #include <sys/socket.h>
-#include <sys/select.h>
+#include <sys/epoll.h>
+#include <sys/timerfd.h>
+#include <sys/eventfd.h>
+#include <sys/uio.h>
+#include <poll.h>
+#include <sys/ioctl.h>
 #include <stdint.h>
 #include <unistd.h>
 #include <ctime>
@@ -10,42 +15,41 @@
 #include <arpa/inet.h>
 
 #include "network.h"
+#include "rgbdsend.h"
+#include "cloud.h"
+#include "config.h"
+#include "jobqueue.h"
+#include "stats.h"
 
-char curl_errbuf[CURL_ERROR_SIZE];
-
-CURL *init_curl(void) {
+void init_curl(void) {
 	curl_global_init(CURL_GLOBAL_ALL);
-	return curl_easy_init();	
 }
 
-static int readfile_callback(void *ptr, size_t size, size_t nmemb, void *userdata) {
+static size_t readfile_callback(char *ptr, size_t size, size_t nmemb, void *userdata) {
 	FILE *file = (FILE *)userdata;
 	
 	return fread(ptr, size, nmemb, file);
 }
 
-void send_file(CURL *curl, char *filename, char *url, char *user, char *password) {	
-	FILE *file = fopen(filename, "r");
-	
-	if(file == NULL) {
-		printf("Upload Error: Could't read '%s': %s.\n", filename, strerror(errno));
-		return;
-	}	
-	
-	int fsize;
-	
-	fseek(file, 0, SEEK_END);
-	fsize = ftell(file);
-	fseek(file, 0, SEEK_SET);
+static size_t readcloud_callback(char *ptr, size_t size, size_t nmemb, void *userdata) {
+	CloudStream *stream = (CloudStream *)userdata;
 	
+	return stream->read(ptr, size*nmemb);
+}
+
+static char *make_userpwd(const char *user, const char *password) {
 	int userlen = strlen(user);	
 	char *buf = new char[userlen+strlen(password)+2];
 	strcpy(buf, user);
 	buf[userlen] = ':';
 	strcpy(buf+userlen+1, password);
 	
+	return buf;
+}
+
+static char *make_url(const char *url, const char *filename) {
 	int urllen = strlen(url);
-	int urlbufsize = strlen(filename) + urllen;
+	int urlbufsize = strlen(filename) + urllen + 1;
 	
 	if(url[urllen-1] != '/')
 		urlbufsize++;
@@ -59,48 +63,375 @@ void send_file(CURL *curl, char *filename, char *url, char *user, char *password
 	
 	strcat(urlbuf,filename);
 	
-	curl_easy_setopt(curl, CURLOPT_USERPWD, buf);
+	return urlbuf;
+}
+
+static long long now_ms(void) {
+	struct timespec tp;
+	clock_gettime(CLOCK_MONOTONIC, &tp);
+	return tp.tv_sec*1000LL+tp.tv_nsec/1000000;
+}
+
+Uploader::Uploader() {
+	this->conf = NULL;
+	this->nextconf = NULL;
+	this->multi = NULL;
+	this->running = 0;
+	this->pending = 0;
+	this->closing = false;
+	this->started = false;
+	this->wakefd = eventfd(0, EFD_NONBLOCK | EFD_CLOEXEC);
+	
+	pthread_mutex_init(&this->lock, NULL);
+}
+
+Uploader::~Uploader() {
+	finish();
+	
+	for(size_t i = 0; i < this->idle.size(); i++)
+		curl_easy_cleanup(this->idle[i]);
+	
+	if(this->multi != NULL)
+		curl_multi_cleanup(this->multi);
+	
+	close(this->wakefd);
+	pthread_mutex_destroy(&this->lock);
+	
+	delete this->conf;
+	delete this->nextconf;
+}
+
+void Uploader::start(Config &conf) {
+	this->conf = new Config(conf);
+	this->multi = curl_multi_init();
+	
+	int rc = pthread_create(&this->tid, NULL, Uploader::thread, this);
+	if(rc != 0) {
+		printf("Upload Error: Couldn't start upload thread: %s\n", strerror(rc));
+		exit(1);
+	}
+	
+	this->started = true;
+}
+
+void Uploader::configure(Config &conf) {
+	Config *next = new Config(conf);
+	uint64_t one = 1;
+	
+	pthread_mutex_lock(&this->lock);
+	delete this->nextconf;
+	this->nextconf = next;
+	pthread_mutex_unlock(&this->lock);
 	
-	curl_easy_setopt(curl, CURLOPT_ERRORBUFFER, curl_errbuf);
-	curl_easy_setopt(curl, CURLOPT_READFUNCTION, readfile_callback);
-    curl_easy_setopt(curl, CURLOPT_UPLOAD, 1L);
-    curl_easy_setopt(curl, CURLOPT_URL, urlbuf);
-    curl_easy_setopt(curl, CURLOPT_READDATA, file);
-    curl_easy_setopt(curl, CURLOPT_INFILESIZE_LARGE, (curl_off_t) fsize);
+	if(write(this->wakefd, &one, sizeof(one)) != sizeof(one))
+		printf("Upload Error: Couldn't wake upload thread: %s\n", strerror(errno));
+}
+
+void Uploader::sendFile(char *filename) {
+	Upload *up = new Upload;
+	up->filename = filename;
+	up->cloud = NULL;
+	up->format = 0;
+	push(up);
+}
+
+void Uploader::sendCloud(PointCloud *cloud, int format, char *filename) {
+	Upload *up = new Upload;
+	up->filename = filename;
+	up->cloud = cloud;
+	up->format = format;
+	push(up);
+}
+
+void Uploader::push(Upload *up) {
+	uint64_t one = 1;
+	
+	up->attempts = 0;
+	up->due = 0;
+	up->curl = NULL;
+	up->file = NULL;
+	up->stream = NULL;
+	
+	pthread_mutex_lock(&this->lock);
+	this->incoming.push_back(up);
+	this->pending++;
+	pthread_mutex_unlock(&this->lock);
+	
+	if(write(this->wakefd, &one, sizeof(one)) != sizeof(one))
+		printf("Upload Error: Couldn't wake upload thread: %s\n", strerror(errno));
+}
+
+void Uploader::finish(void) {
+	uint64_t one = 1;
+	
+	if(!this->started)
+		return;
+	
+	pthread_mutex_lock(&this->lock);
+	this->closing = true;
+	pthread_mutex_unlock(&this->lock);
+	
+	if(write(this->wakefd, &one, sizeof(one)) != sizeof(one))
+		printf("Upload Error: Couldn't wake upload thread: %s\n", strerror(errno));
+	
+	pthread_join(this->tid, NULL);
+	this->started = false;
+}
+
+int Uploader::size(void) {
+	pthread_mutex_lock(&this->lock);
+	int n = this->pending;
+	pthread_mutex_unlock(&this->lock);
+	
+	return n;
+}
+
+void *Uploader::thread(void *arg) {
+	((Uploader *)arg)->run();
+	return NULL;
+}
+
+void Uploader::run(void) {
+	while(1) {
+		uint64_t n;
+		bool closing;
+		
+		while(read(this->wakefd, &n, sizeof(n)) > 0);
+		
+		pthread_mutex_lock(&this->lock);
+		while(!this->incoming.empty()) {
+			this->waiting.push_back(this->incoming.front());
+			this->incoming.pop_front();
+		}
+		if(this->nextconf != NULL) {
+			delete this->conf;
+			this->conf = this->nextconf;
+			this->nextconf = NULL;
+		}
+		closing = this->closing;
+		if(closing && this->pending == 0) {
+			pthread_mutex_unlock(&this->lock);
+			break;
+		}
+		pthread_mutex_unlock(&this->lock);
+		
+		int maxtransfers = this->conf->dest_transfers > 0 ? this->conf->dest_transfers : 1;
+		
+		int still;
+		curl_multi_perform(this->multi, &still);
+		
+		CURLMsg *msg;
+		int left;
+		while((msg = curl_multi_info_read(this->multi, &left)) != NULL) {
+			if(msg->msg != CURLMSG_DONE)
+				continue;
+			
+			Upload *up;
+			curl_easy_getinfo(msg->easy_handle, CURLINFO_PRIVATE, (char **)&up);
+			end(up, msg->data.result);
+		}
+		
+		// start due uploads in the order they were queued. retries aren't
+		// waited for when closing.
+		long long now = now_ms();
+		long long next = -1;
+		for(size_t i = 0; i < this->waiting.size();) {
+			Upload *up = this->waiting[i];
+			
+			if(closing && up->attempts > 0) {
+				this->waiting.erase(this->waiting.begin()+i);
+				giveUp(up);
+			} else if(up->due <= now && this->running < maxtransfers) {
+				this->waiting.erase(this->waiting.begin()+i);
+				begin(up);
+			} else {
+				if(up->due > now && (next == -1 || up->due < next))
+					next = up->due;
+				i++;
+			}
+		}
+		
+		if(closing && this->running == 0 && this->waiting.empty())
+			continue;
+		
+		// curl shortens the wait further if a transfer needs it.
+		int timeout = 1000;
+		if(next != -1 && next-now < timeout)
+			timeout = next-now;
+		
+		curl_waitfd wfd;
+		wfd.fd = this->wakefd;
+		wfd.events = CURL_WAIT_POLLIN;
+		wfd.revents = 0;
+		curl_multi_wait(this->multi, &wfd, 1, timeout, NULL);
+	}
+}
+
+// opens the source of up and adds a transfer for it. an upload that can't
+// start is finished here.
+void Uploader::begin(Upload *up) {
+	curl_off_t size;
+	
+	// a reload may have removed the destination after up was queued.
+	if(this->conf->dest_url == NULL || this->conf->dest_username == NULL || this->conf->dest_password == NULL) {
+		printf("Upload Error: No destination server specified for '%s'.\n", up->filename);
+		giveUp(up);
+		return;
+	}
+	
+	if(up->cloud == NULL) {
+		up->file = fopen(up->filename, "r");
+		
+		if(up->file == NULL) {
+			printf("Upload Error: Could't read '%s': %s.\n", up->filename, strerror(errno));
+			done(up);
+			return;
+		}
+		
+		fseek(up->file, 0, SEEK_END);
+		size = ftell(up->file);
+		fseek(up->file, 0, SEEK_SET);
+	} else {
+		up->stream = open_cloud_stream(*up->cloud, up->format);
+		size = up->stream->size();
+	}
+	
+	// finished handles are kept, so their connections stay alive in the
+	// multi handle's cache.
+	CURL *curl;
+	if(this->idle.empty()) {
+		curl = curl_easy_init();
+	} else {
+		curl = this->idle.back();
+		this->idle.pop_back();
+	}
+	
+	char *userpwd = make_userpwd(this->conf->dest_username, this->conf->dest_password);
+	char *urlbuf = make_url(this->conf->dest_url, up->filename);
+	up->errbuf[0] = 0;
+	
+	curl_easy_setopt(curl, CURLOPT_USERPWD, userpwd);
+	curl_easy_setopt(curl, CURLOPT_ERRORBUFFER, up->errbuf);
+	curl_easy_setopt(curl, CURLOPT_PRIVATE, (void *)up);
+	curl_easy_setopt(curl, CURLOPT_NOSIGNAL, 1L);
+	if(up->cloud == NULL) {
+		curl_easy_setopt(curl, CURLOPT_READFUNCTION, readfile_callback);
+		curl_easy_setopt(curl, CURLOPT_READDATA, up->file);
+	} else {
+		curl_easy_setopt(curl, CURLOPT_READFUNCTION, readcloud_callback);
+		curl_easy_setopt(curl, CURLOPT_READDATA, up->stream);
+	}
+	curl_easy_setopt(curl, CURLOPT_UPLOAD, 1L);
+	curl_easy_setopt(curl, CURLOPT_URL, urlbuf);
+	curl_easy_setopt(curl, CURLOPT_INFILESIZE_LARGE, size);
 	curl_easy_setopt(curl, CURLOPT_USE_SSL, CURLUSESSL_TRY);
 	curl_easy_setopt(curl, CURLOPT_SSL_VERIFYPEER, 0L);
 	curl_easy_setopt(curl, CURLOPT_SSL_VERIFYHOST, 0L);
 	
-	if(curl_easy_perform(curl) != 0) {
-		printf("Upload Error: %s.\n", curl_errbuf);
-	} else {
-		printf("Upload successful.\n");
+	delete[] userpwd; // curl keeps copies
+	delete[] urlbuf;
+	
+	up->curl = curl;
+	clock_gettime(CLOCK_MONOTONIC, &up->started);
+	curl_multi_add_handle(this->multi, curl);
+	this->running++;
+}
+
+// cleans up a finished transfer and schedules a retry if it failed.
+void Uploader::end(Upload *up, CURLcode result) {
+	curl_off_t sent = 0;
+	curl_easy_getinfo(up->curl, CURLINFO_SIZE_UPLOAD_T, &sent);
+	stats_add(STAT_BYTES_UPLOADED, sent);
+	stats_add(result == CURLE_OK ? STAT_UPLOADS : STAT_UPLOADS_FAILED, 1);
+	stats_time(STAGE_UPLOAD, up->started);
+	
+	curl_multi_remove_handle(this->multi, up->curl);
+	this->idle.push_back(up->curl);
+	this->running--;
+	up->curl = NULL;
+	
+	if(up->file != NULL)
+		fclose(up->file);
+	delete up->stream;
+	up->file = NULL;
+	up->stream = NULL;
+	
+	if(result == CURLE_OK) {
+		printf("Uploaded '%s'.\n", up->filename);
+		done(up);
+		return;
 	}
 	
-	curl_easy_reset(curl);
+	printf("Upload Error: '%s': %s.\n", up->filename, up->errbuf[0] ? up->errbuf : curl_easy_strerror(result));
+	up->attempts++;
 	
-	fclose(file);
-	delete[] buf;
-	delete[] urlbuf;
+	if(up->attempts > this->conf->dest_retries) {
+		giveUp(up);
+		return;
+	}
+	
+	long long delay = this->conf->dest_retry_delay;
+	for(int i = 1; i < up->attempts && delay < UPLOAD_MAX_BACKOFF; i++)
+		delay *= 2;
+	if(delay > UPLOAD_MAX_BACKOFF)
+		delay = UPLOAD_MAX_BACKOFF;
+	
+	printf("Retrying in %lld ms (%d/%d).\n", delay, up->attempts, this->conf->dest_retries);
+	up->due = now_ms()+delay;
+	this->waiting.push_back(up);
 }
 
-void curl_cleanup(CURL* curl) {
-	curl_easy_cleanup(curl);
+void Uploader::giveUp(Upload *up) {
+	if(up->cloud != NULL) {
+		printf("Saving point cloud to '%s' instead.\n", up->filename);
+		export_cloud(up->filename, *up->cloud, up->format);
+	} else {
+		printf("Giving up on '%s'. It stays on disk.\n", up->filename);
+	}
+	
+	done(up);
+}
+
+void Uploader::done(Upload *up) {
+	release_cloud(up->cloud);
+	delete[] up->filename;
+	delete up;
+	
+	pthread_mutex_lock(&this->lock);
+	this->pending--;
+	pthread_mutex_unlock(&this->lock);
+}
+
+void cleanup_curl(void) {
 	curl_global_cleanup();
 }
 
 Daemon::Daemon() {
 	this->sock = -1;
 	this->port = 0;
+	this->epfd = -1;
 	
 	this->csock = -1;
+	
+	this->outpos = 0;
+	this->outwatched = false;
+	this->cloudout = NULL;
+	this->cloudbytes = 0;
+	
+	for(int i = 0; i < DAEMON_MAX_CONNECTIONS; i++) {
+		conns[i].sock = -1;
+		conns[i].timer = -1;
+	}
 }
 
 void Daemon::init(int port, int timeout) {
 	sockaddr_in name;
-	this->sock = socket(AF_INET,SOCK_STREAM,0);
+	this->sock = socket(AF_INET, SOCK_STREAM | SOCK_NONBLOCK | SOCK_CLOEXEC, 0);
 	this->port = port;
 	
+	int one = 1;
+	setsockopt(this->sock, SOL_SOCKET, SO_REUSEADDR, &one, sizeof(one));
+	
 	name.sin_family = AF_INET;
 	name.sin_addr.s_addr = htonl(INADDR_ANY);
 	name.sin_port = htons(port);
@@ -115,112 +446,414 @@ void Daemon::init(int port, int timeout) {
 		exit(1);
 	}
 	
+	this->epfd = epoll_create1(EPOLL_CLOEXEC);
+	if(this->epfd == -1) {
+		printf("Daemon Error: Failed to create epoll instance: %s\n", strerror(errno));
+		exit(1);
+	}
+	
+	epoll_event ev;
+	ev.events = EPOLLIN;
+	ev.data.fd = this->sock;
+	epoll_ctl(this->epfd, EPOLL_CTL_ADD, this->sock, &ev);
+	
 	this->timeout = timeout;
 	
 	printf("Listening on port %d\n", port);
 }
 
-void Daemon::acceptConnection(void) {
-	int cs;
-	
-	cs = accept(this->sock, 0, 0);
+void Daemon::watch(int fd) {
+	epoll_event ev;
+	ev.events = EPOLLIN | EPOLLET; // reported once per change, so it needn't be read
+	ev.data.fd = fd;
+	epoll_ctl(this->epfd, EPOLL_CTL_ADD, fd, &ev);
+}
+
+Daemon::Connection *Daemon::findConnection(int fd) {
+	for(int i = 0; i < DAEMON_MAX_CONNECTIONS; i++) {
+		if(conns[i].sock != -1 && (conns[i].sock == fd || conns[i].timer == fd))
+			return &conns[i];
+	}
 	
-	Command c;
-	int r;
-	do {
-		r = receiveCommandSock(cs, &c);
-		if(r == 0)
-			return;
-	} while(r == 2); // filter keep alives	
+	return NULL;
+}
+
+void Daemon::resetTimer(Connection *c) {
+	itimerspec its;
+	memset(&its, 0, sizeof(its));
+	its.it_value.tv_sec = this->timeout;
+	timerfd_settime(c->timer, 0, &its, NULL);
+}
+
+void Daemon::acceptConnections(void) {
+	int cs;
 	
-	if(strncmp(c.header, "subs", 4) == 0) {
-		if(this->csock == -1) {
-			int rc = sendCommandSock(cs, "okay", 0, 0);
-			if(rc) {
-				this->csock = cs;
-				printf("Client connected.\n");
-			}
-		} else {
-			sendCommandSock(cs, "fail", 0, 0);
+	while((cs = accept4(this->sock, 0, 0, SOCK_NONBLOCK | SOCK_CLOEXEC)) != -1) {
+		Connection *c = NULL;
+		for(int i = 0; i < DAEMON_MAX_CONNECTIONS && c == NULL; i++) {
+			if(conns[i].sock == -1)
+				c = &conns[i];
 		}
-	}	
+		
+		int timer = c ? timerfd_create(CLOCK_MONOTONIC, TFD_NONBLOCK | TFD_CLOEXEC) : -1;
+		if(timer == -1) {
+			printf("Daemon Error: Too many connections.\n");
+			close(cs);
+			continue;
+		}
+		
+		c->sock = cs;
+		c->timer = timer;
+		c->got = 0;
+		
+		epoll_event ev;
+		ev.events = EPOLLIN;
+		ev.data.fd = cs;
+		epoll_ctl(this->epfd, EPOLL_CTL_ADD, cs, &ev);
+		ev.data.fd = timer;
+		epoll_ctl(this->epfd, EPOLL_CTL_ADD, timer, &ev);
+		
+		resetTimer(c);
+	}
+}
+
+void Daemon::closeSock(Connection *c) {
+	if(c->sock == this->csock) {
+		printf("Client disconnected.\n");
+		clearOutput();
+		this->csock = -1;
+	}
+	
+	epoll_ctl(this->epfd, EPOLL_CTL_DEL, c->sock, NULL);
+	epoll_ctl(this->epfd, EPOLL_CTL_DEL, c->timer, NULL);
+	close(c->sock);
+	close(c->timer);
+	c->sock = -1;
+	c->timer = -1;
 }
 
 void Daemon::closeConnection(void) {
-	printf("Client disconnected.\n");
-	close(this->csock);
-	this->csock = -1;
+	Connection *c = findConnection(this->csock);
+	
+	if(c != NULL)
+		closeSock(c);
 }
 
-int Daemon::recvAll(int sock, void *buf, size_t length) {
-	uint readbytes = 0;
-	int lastrecv = clock();
-	while(readbytes < length) {
-		int n = recv(sock, ((char *)buf)+readbytes, length-readbytes, 0);
-		if(n == -1 || clock() - lastrecv > timeout*CLOCKS_PER_SEC)
+// reads what's available of the next command header. returns 1 if a complete
+// header is in c->header, 0 if more data is needed and -1 if the connection
+// was closed.
+int Daemon::readHeader(Connection *c) {
+	while(c->got < 4) {
+		int n = recv(c->sock, c->header+c->got, 4-c->got, 0);
+		
+		if(n == 0 || (n == -1 && errno != EAGAIN && errno != EWOULDBLOCK && errno != EINTR)) {
+			closeSock(c);
 			return -1;
-				
-		if(n > 0) {
-			readbytes += n;
-			lastrecv = clock();			
 		}
+		
+		if(n == -1)
+			return 0;
+		
+		c->got += n;
+		resetTimer(c);
 	}
 	
-	return length;
+	c->got = 0;
+	return 1;
 }
 
-int Daemon::receiveCommandSock(int sock, Command *buf) {
-	uint n;
+int Daemon::waitCommand(Command *cmd, int timeoutms) {
+	epoll_event events[DAEMON_MAX_CONNECTIONS*2+1];
 	
-	if(sock == -1)
-		return 0;
+	int n = epoll_wait(this->epfd, events, DAEMON_MAX_CONNECTIONS*2+1, timeoutms);
 	
-	n = recvAll(sock, this->buf, 4);
-	if(n != 4)
-		return 0;
+	// epoll is level triggered, so anything not handled before returning a
+	// command is reported again by the next call.
+	for(int i = 0; i < n; i++) {
+		int fd = events[i].data.fd;
+		
+		if(fd == this->sock) {
+			acceptConnections();
+			continue;
+		}
+		
+		Connection *c = findConnection(fd);
+		if(c == NULL) // a watched fd
+			return 0;
+		
+		if(fd == c->timer) // handled below
+			continue;
+		
+		if(events[i].events & EPOLLOUT)
+			flush();
+		
+		if(c->sock == -1 || !(events[i].events & (EPOLLIN | EPOLLHUP | EPOLLERR)))
+			continue;
+		
+		if(readHeader(c) != 1)
+			continue;
 		
-	strncpy(buf->header, this->buf, 4);
-	buf->datalen = 0;
-	buf->data = 0;
-	
 // as of now, the client doesn't have any commands with data blocks, so we're
 // done.
+		
+		if(strncmp(c->header, "aliv", 4) == 0) // filter keep-alives.
+			continue;
+		
+		if(c->sock != this->csock) {
+			// not subscribed yet. the only valid command is subs.
+			if(strncmp(c->header, "subs", 4) == 0 && this->csock == -1 && sendCommandSock(c->sock, "okay", 0, 0)) {
+				this->csock = c->sock;
+				printf("Client connected.\n");
+			} else {
+				sendCommandSock(c->sock, "fail", 0, 0);
+				closeSock(c);
+			}
+			continue;
+		}
+		
+		strncpy(cmd->header, c->header, 4);
+		cmd->datalen = 0;
+		cmd->data = 0;
+		return 1;
+	}
 	
-	if(strcmp(buf->header, "aliv") == 0) { // filter keep-alives.
-		return 2;
-	}	
+	// timers go last, so data that arrived in the same batch rearms them
+	// first. rearming clears the expiration, even if epoll_wait already
+	// reported it.
+	for(int i = 0; i < n; i++) {
+		Connection *c = findConnection(events[i].data.fd);
+		uint64_t expired = 0;
+		
+		if(c == NULL || events[i].data.fd != c->timer)
+			continue;
+		if(read(c->timer, &expired, sizeof(expired)) != sizeof(expired) || expired == 0)
+			continue;
+		
+		if(c->sock == this->csock)
+			printf("Client timed out.\n");
+		closeSock(c);
+	}
+	
+	return 0;
+}
+
+// sends all iovecs, waiting for the socket to become writable for at most
+// timeout seconds at a time. iov is modified.
+int Daemon::sendAll(int sock, iovec *iov, int iovcnt) {
+	msghdr msg;
+	memset(&msg, 0, sizeof(msg));
+	
+	while(iovcnt > 0) {
+		msg.msg_iov = iov;
+		msg.msg_iovlen = iovcnt;
+		
+		ssize_t n = sendmsg(sock, &msg, MSG_NOSIGNAL);
 		
+		if(n == -1 && (errno == EAGAIN || errno == EWOULDBLOCK)) {
+			pollfd pfd;
+			pfd.fd = sock;
+			pfd.events = POLLOUT;
+			if(poll(&pfd, 1, this->timeout*1000) <= 0)
+				return 0;
+			continue;
+		}
+		
+		if(n == -1 && errno == EINTR)
+			continue;
+		
+		if(n == -1)
+			return 0;
+		
+		// skip what was sent.
+		while(iovcnt > 0 && (size_t)n >= iov->iov_len) {
+			n -= iov->iov_len;
+			iov++;
+			iovcnt--;
+		}
+		
+		if(iovcnt > 0) {
+			iov->iov_base = (char *)iov->iov_base+n;
+			iov->iov_len -= n;
+		}
+	}
+	
 	return 1;
 }
 
 int Daemon::sendCommandSock(int sock, const char* cmd, void *data, uint32_t len) {
-	uint n;
-	
 	if(sock == -1)
 		return 0;
 	
-	strncpy(this->buf, cmd, 4);
-	*((uint32_t*)(this->buf+4)) = htonl(len);
+	char header[8];
+	strncpy(header, cmd, 4);
+	uint32_t nlen = htonl(len);
+	memcpy(header+4, &nlen, 4);
+	
+	// the data block goes out straight from the caller's buffer.
+	iovec iov[2];
+	iov[0].iov_base = header;
+	iov[0].iov_len = 4+(len != 0)*4;
+	iov[1].iov_base = data;
+	iov[1].iov_len = len;
 	
-	if(len > COMMAND_MAXSIZE-8)
+	return sendAll(sock, iov, len != 0 ? 2 : 1);
+}
+	
+int Daemon::sendCommand(const char *cmd, void *data, uint32_t len) {
+	if(this->csock == -1)
 		return 0;
 	
-	memcpy(this->buf+8, data, len);
+	queueCommand(cmd, data, len);
+	flush();
 	
-	n = send(sock, this->buf, 4+(len != 0)*(4+len), 0);
+	return this->csock != -1;
+}
+
+void Daemon::sendClouds(std::vector<PointCloud *> &clouds, int format) {
+	for(size_t i = 0; i < clouds.size(); i++) {
+		if(this->csock == -1) {
+			release_cloud(clouds[i]);
+			continue;
+		}
 		
-	if(n != 4+(len != 0)*(4+len))
-		return 0;
+		PendingCloud p = {clouds[i], format, i == 0 ? (int)clouds.size() : 1};
+		this->cloudq.push_back(p);
+	}
+	clouds.clear();
 	
-	return 1;
+	flush();
 }
 
-int Daemon::receiveCommand(Command *buf) {
-	return receiveCommandSock(this->csock, buf);
+void Daemon::queueCommand(const char *cmd, void *data, uint32_t len) {
+	Output out;
+	out.len = 4+(len != 0)*(4+len);
+	out.buf = new char[out.len];
+	
+	strncpy(out.buf, cmd, 4);
+	if(len != 0) {
+		uint32_t nlen = htonl(len);
+		memcpy(out.buf+4, &nlen, 4);
+		memcpy(out.buf+8, data, len);
+	}
+	
+	this->outq.push_back(out);
 }
+
+// queues the next chunk of the clouds to be sent. returns false if there are
+// none. chunks are serialized straight into the output buffer.
+bool Daemon::nextChunk(void) {
+	if(this->cloudq.empty())
+		return false;
 	
-int Daemon::sendCommand(const char *cmd, void *data, uint32_t len) {
-	return sendCommandSock(this->csock, cmd, data, len);
+	PendingCloud &p = this->cloudq.front();
+	
+	if(this->cloudout == NULL) {
+		this->cloudout = open_cloud_stream(*p.cloud, p.format);
+		this->cloudbytes = 0;
+		
+		if(p.count > 1) {
+			uint32_t count = htonl(p.count);
+			queueCommand("ccnt", &count, sizeof(count));
+			return true;
+		}
+	}
+	
+	Output out;
+	out.buf = new char[8+rgbdsend::cloud_chunk_size];
+	size_t n = this->cloudout->read(out.buf+8, rgbdsend::cloud_chunk_size);
+	
+	if(n > 0) {
+		uint32_t nlen = htonl(n);
+		memcpy(out.buf, "clod", 4);
+		memcpy(out.buf+4, &nlen, 4);
+		out.len = 8+n;
+		this->outq.push_back(out);
+		this->cloudbytes += n;
+		return true;
+	}
+	
+	delete[] out.buf;
+	queueCommand("cend", 0, 0);
+	printf("Sent point cloud to client. %ld bytes\n", this->cloudbytes);
+	
+	delete this->cloudout;
+	this->cloudout = NULL;
+	release_cloud(p.cloud);
+	this->cloudq.pop_front();
+	
+	return true;
+}
+
+// writes queued output until the socket is full. csock is watched for
+// EPOLLOUT as long as anything is left.
+void Daemon::flush(void) {
+	while(this->csock != -1 && (!this->outq.empty() || nextChunk())) {
+		Output &out = this->outq.front();
+		ssize_t n = send(this->csock, out.buf+this->outpos, out.len-this->outpos, MSG_NOSIGNAL);
+		
+		if(n == -1 && errno == EINTR)
+			continue;
+		
+		if(n == -1 && (errno == EAGAIN || errno == EWOULDBLOCK))
+			break;
+		
+		if(n == -1) {
+			printf("Daemon Error: Failed to send to client: %s\n", strerror(errno));
+			closeConnection();
+			return;
+		}
+		
+		this->outpos += n;
+		if(this->outpos == out.len) {
+			delete[] out.buf;
+			this->outq.pop_front();
+			this->outpos = 0;
+		}
+	}
+	
+	bool pending = this->csock != -1 && !this->outq.empty();
+	if(pending != this->outwatched) {
+		epoll_event ev;
+		ev.events = EPOLLIN | (pending ? EPOLLOUT : 0);
+		ev.data.fd = this->csock;
+		epoll_ctl(this->epfd, EPOLL_CTL_MOD, this->csock, &ev);
+		this->outwatched = pending;
+	}
+}
+
+// drops what wasn't sent to the client.
+void Daemon::clearOutput(void) {
+	for(size_t i = 0; i < this->outq.size(); i++)
+		delete[] this->outq[i].buf;
+	this->outq.clear();
+	this->outpos = 0;
+	this->outwatched = false;
+	
+	delete this->cloudout;
+	this->cloudout = NULL;
+	for(size_t i = 0; i < this->cloudq.size(); i++)
+		release_cloud(this->cloudq[i].cloud);
+	this->cloudq.clear();
+}
+
+bool Daemon::canSend(uint32_t len) {
+	int queued = 0;
+	int sndbuf = 0;
+	socklen_t optlen = sizeof(sndbuf);
+	
+	if(this->csock == -1 || !this->outq.empty())
+		return false;
+	
+	if(ioctl(this->csock, TIOCOUTQ, &queued) == -1 || getsockopt(this->csock, SOL_SOCKET, SO_SNDBUF, &sndbuf, &optlen) == -1)
+		return true;
+	
+	// linux reports twice the usable size. data bigger than the buffer can
+	// only go out when nothing else is queued.
+	sndbuf /= 2;
+	if(len+8 > (uint32_t)sndbuf)
+		return queued == 0;
+	
+	return queued+len+8 <= (uint32_t)sndbuf;
 }
 
 Command::Command() {
@@ -1,10 +1,16 @@
 #ifndef NETWORK_H
 #define NETWORK_H
 
+#include <stdint.h>
+#include <ctime>
+#include <pthread.h>
+#include <deque>
+#include <vector>
 #include <curl/curl.h>
 
 enum {
-	COMMAND_MAXSIZE = 65536
+	DAEMON_MAX_CONNECTIONS = 8, // subscribed client and connections waiting for subs
+	UPLOAD_MAX_BACKOFF = 60000 // ms
 };
 
 class Command {
@@ -17,19 +23,77 @@ public:
 	void *data;
 };
 
+struct PointCloud;
+class CloudStream;
+
 class Daemon {
 private:
-	int receiveCommandSock(int sock, Command *buf);
+	// per connection parse state. every connection has a timerfd that closes
+	// it if nothing is received for timeout seconds.
+	struct Connection {
+		int sock;
+		int timer;
+		char header[4];
+		int got;
+	};
+	
+	Connection *findConnection(int fd);
+	void resetTimer(Connection *c);
+	void acceptConnections(void);
+	void closeSock(Connection *c);
+	int readHeader(Connection *c);
+	
 	int sendCommandSock(int sock, const char*, void *data, uint32_t len);
+	int sendAll(int sock, struct iovec *iov, int iovcnt);
+	
+	// output to the subscribed client is queued and written by flush
+	// whenever the socket takes it, so the loop never waits for the client.
+	struct Output {
+		char *buf;
+		uint32_t len;
+	};
+	
+	struct PendingCloud {
+		PointCloud *cloud;
+		int format;
+		int count; // announced by ccnt before the cloud if more than one
+	};
 	
-	int recvAll(int sock, void *buf, size_t length);
+	void queueCommand(const char *cmd, void *data, uint32_t len);
+	bool nextChunk(void);
+	void flush(void);
+	void clearOutput(void);
+	
+	Connection conns[DAEMON_MAX_CONNECTIONS];
+	int epfd;
+	
+	std::deque<Output> outq;
+	uint32_t outpos; // sent of outq.front()
+	bool outwatched; // csock is watched for EPOLLOUT
+	
+	std::deque<PendingCloud> cloudq;
+	CloudStream *cloudout; // of cloudq.front() once its first chunk is queued
+	long cloudbytes;
 public:
 	Daemon();
 	
 	void init(int port, int timeout);
-	void acceptConnection(void);
-	int receiveCommand(Command *buf);
+	// makes waitCommand return when fd becomes readable. reading it is up to
+	// the caller.
+	void watch(int fd);
+	// handles connections until the subscribed client sends a command or
+	// timeoutms (-1: infinite) passed. returns 1 if cmd holds a command.
+	int waitCommand(Command *cmd, int timeoutms);
+	// queues a command for the subscribed client. returns 0 if there is none.
 	int sendCommand(const char*, void *data, uint32_t len);
+	// queues clouds for the client in clod chunks followed by cend each,
+	// announced by ccnt if there are several. the chunks are serialized one
+	// at a time as the client takes them, and commands sent meanwhile go out
+	// between them. takes over the references to clouds.
+	void sendClouds(std::vector<PointCloud *> &clouds, int format);
+	// true if nothing is queued for the client and a command with len bytes
+	// of data fits into the socket's send buffer.
+	bool canSend(uint32_t len);
 	void closeConnection(void);
 	
 	int sock;
@@ -38,12 +102,74 @@ public:
 	int csock;
 	
 	int timeout;
+};
+
+class Config;
+
+// Uploads captures to the destination server from a thread of its own. Up to
+// dest_transfers uploads run at once on a curl multi handle, whose connection
+// cache lets them reuse connections and sessions from earlier files. Failed
+// uploads are retried with exponential backoff.
+class Uploader {
+public:
+	Uploader();
+	~Uploader();
+	
+	void start(Config &conf);
+	// uploads started from now on use a copy of conf.
+	void configure(Config &conf);
+	// uploads the file filename. takes ownership of filename.
+	void sendFile(char *filename);
+	// uploads cloud as filename without writing it to disk first. takes
+	// ownership of filename and a reference to cloud.
+	void sendCloud(PointCloud *cloud, int format, char *filename);
+	// lets running uploads finish without retrying failures and stops the
+	// thread.
+	void finish(void);
+	int size(void);
+	
+private:
+	struct Upload {
+		char *filename;
+		PointCloud *cloud; // NULL for a file upload
+		int format;
+		int attempts;
+		long long due; // ms, CLOCK_MONOTONIC
+		struct timespec started;
+		
+		CURL *curl; // the rest is only valid while the upload runs
+		FILE *file;
+		CloudStream *stream;
+		char errbuf[CURL_ERROR_SIZE];
+	};
+	
+	static void *thread(void *arg);
+	void run(void);
+	void push(Upload *up);
+	void begin(Upload *up);
+	void end(Upload *up, CURLcode result);
+	void giveUp(Upload *up);
+	void done(Upload *up);
+	
+	Config *conf; // owned by the upload thread
+	Config *nextconf; // taken over by the upload thread when it wakes up
+	
+	CURLM *multi;
+	std::vector<CURL *> idle;
+	std::vector<Upload *> waiting; // owned by the upload thread
+	int running;
+	
+	std::deque<Upload *> incoming;
+	int pending; // uploads not done yet
+	bool closing;
+	int wakefd;
 	
-	char buf[COMMAND_MAXSIZE];
+	pthread_t tid;
+	bool started;
+	pthread_mutex_t lock;
 };
 
-CURL *init_curl(void);
-void send_file(CURL *curl, char *filename, char *url, char *user, char *password);
-void cleanup_curl(CURL *curl);
+void init_curl(void);
+void cleanup_curl(void);
 
 #endif
\ No newline at end of file
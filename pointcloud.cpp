@@ -1,96 +1,291 @@
 #include <cstdio>
-#include <OpenNI.h>
 #include <cmath>
+#include <cstring>
+#include <pthread.h>
 
 #include "pointcloud.h"
 #include "capture.h"
+#include "framesource.h"
 
-PointCloud::PointCloud(int num) {
-	num = num;
-	
-	x = new float[num];
-	y = new float[num];
-	z = new float[num];
-	r = new uint8_t[num];
-	g = new uint8_t[num];
-	b = new uint8_t[num];
-		
+RayTable::RayTable() {
+	xz = NULL;
+	yz = NULL;
+	colx = NULL;
+	coly = NULL;
+	
+	resx = resy = 0;
+	cropx = cropy = cropw = croph = 0;
+	hfov = vfov = 0.f;
+	colordw = colordh = colorcw = colorch = 0;
+}
+
+RayTable::~RayTable() {
+	delete[] xz;
+	delete[] yz;
+	delete[] colx;
+	delete[] coly;
 }
 
-PointCloud::~PointCloud() {
-	delete[] x;
-	delete[] y;
-	delete[] z;
-	delete[] r;
-	delete[] g;
-	delete[] b;	
+void RayTable::update(const StreamInfo &depth) {
+	update(depth.resx, depth.resy, depth.hfov, depth.vfov, depth.cropx, depth.cropy, depth.cropw, depth.croph);
 }
 
+void RayTable::update(int rx, int ry, float h, float v, int cx, int cy, int cw, int ch) {
+	if(xz != NULL && rx == resx && ry == resy && h == hfov && v == vfov
+		&& cx == cropx && cy == cropy && cw == cropw && ch == croph)
+		return;
+	
+	resx = rx;
+	resy = ry;
+	hfov = h;
+	vfov = v;
+	cropx = cx;
+	cropy = cy;
+	cropw = cw;
+	croph = ch;
+	
+	delete[] xz;
+	delete[] yz;
+	xz = new float[cropw];
+	yz = new float[croph];
+	
+	// same projection as openni::CoordinateConverter::convertDepthToWorld,
+	// for depth in millimetres, which every FrameSource delivers. it's
+	// separable, so a factor per column and per row is enough.
+	float xzfactor = tan(hfov/2)*2;
+	float yzfactor = tan(vfov/2)*2;
+	
+	for(int x = 0; x < cropw; x++)
+		xz[x] = ((x+cropx)/(float)resx-.5f)*xzfactor;
+	
+	for(int y = 0; y < croph; y++)
+		yz[y] = (.5f-(y+cropy)/(float)resy)*yzfactor;
+	
+	printf("Built ray table for %dx%d+%d+%d of %dx%d\n", cropw, croph, cropx, cropy, resx, resy);
+}
+
+void RayTable::updateColor(int dw, int dh, int cw, int ch) {
+	if(colx != NULL && dw == colordw && dh == colordh && cw == colorcw && ch == colorch)
+		return;
+	
+	colordw = dw;
+	colordh = dh;
+	colorcw = cw;
+	colorch = ch;
+	
+	delete[] colx;
+	delete[] coly;
+	colx = new int[dw];
+	coly = new int[dh];
+	
+	// scaling is separable too. the color pixel is the one the depth pixel's
+	// top left corner falls into.
+	for(int x = 0; x < dw; x++) {
+		int cx = x/(float)dw*cw;
+		if(cx >= cw)
+			cx = cw-1;
+		colx[x] = 3*cx;
+	}
+	
+	for(int y = 0; y < dh; y++) {
+		int cy = y/(float)dh*ch;
+		if(cy >= ch)
+			cy = ch-1;
+		coly[y] = 3*cy*cw;
+	}
+}
 
-void depth_to_pointcloud(PointCloud &cloud, RawData &raw, openni::VideoStream &depthstrm, openni::VideoStream &clrstrm, float maxdepth) {
-	int x, y;
+struct RowJob {
+	PointCloud *cloud;
+	RawData *raw;
+	RayTable *rays;
+	float maxdepth;
 	
-	float avgdepth;
-	int i = 0;
+	int y0, y1; // rows [y0, y1)
+	int count; // valid points in these rows
+	int offset; // index of the first point in the cloud
+	bool write;
+	int32_t *index; // point of each pixel or -1, written if not NULL
+};
+
+// counts the valid points of a block of rows or, if job->write is set,
+// converts them to the cloud starting at job->offset.
+static void *process_rows(void *arg) {
+	RowJob *job = (RowJob *)arg;
+	RawData &raw = *job->raw;
+	PointCloud &cloud = *job->cloud;
+	int i = job->offset;
+	int n = 0;
 	
-	for(y = 0; y < raw.dresy; y++) {
-		for(x = 0; x < raw.dresx; x++) {
+	for(int y = job->y0; y < job->y1; y++) {
+		const uint8_t *row = raw.color+job->rays->coly[y];
+		
+		for(int x = 0; x < raw.dresx; x++) {
 			if(raw.dframenums[x+y*raw.dresx] == 0)
 				continue;
 			
-			avgdepth = raw.d[x+y*raw.dresx]/(float)raw.dframenums[x+y*raw.dresx];
+			float avgdepth = raw.d[x+y*raw.dresx]/(float)raw.dframenums[x+y*raw.dresx];
 			
-			if(avgdepth > maxdepth*1000.f)
+			if(avgdepth > job->maxdepth*1000.f)
 				continue;
 			
-			int doffx = 0, doffy = 0, tmp1, tmp2;
-			depthstrm.getCropping(&doffx, &doffy, &tmp1, &tmp2);
+			n++;
+			if(!job->write)
+				continue;
 			
-			openni::CoordinateConverter::convertDepthToWorld(depthstrm, (float)(x+doffx), (float)(y+doffy), avgdepth, &cloud.x[i], &cloud.y[i], &cloud.z[i]);
-						
-			int cx = x/(float)raw.dresx*raw.cresx;
-			int cy = y/(float)raw.dresy*raw.cresy;
-						
-			if(cx >= raw.cresx)
-				cx--;
-			if(cy >= raw.cresy)
-				cy--;
+			cloud.set(i, job->rays->xz[x]*avgdepth, job->rays->yz[y]*avgdepth, avgdepth);
 			
-			int cidx = cx+cy*raw.cresx;
+			const uint8_t *c = row+job->rays->colx[x];
+			cloud.rgb[3*i] = c[0];
+			cloud.rgb[3*i+1] = c[1];
+			cloud.rgb[3*i+2] = c[2];
 			
-			cloud.r[i] = raw.r[cidx]/(float)raw.cframenum;
-			cloud.g[i] = raw.g[cidx]/(float)raw.cframenum;
-			cloud.b[i] = raw.b[cidx]/(float)raw.cframenum;
+			if(job->index != NULL)
+				job->index[x+y*raw.dresx] = i;
 			i++;
 			
 // 			cloud.z[i]*=-1;
 		}
+	}
+	
+	job->count = n;
+	return NULL;
+}
+
+static void run_jobs(RowJob *jobs, int threads) {
+	pthread_t *tids = new pthread_t[threads];
+	int started = 0;
+	
+	// the calling thread takes the first block itself.
+	for(int t = 1; t < threads; t++) {
+		if(pthread_create(&tids[t], NULL, process_rows, &jobs[t]) != 0)
+			break;
+		started = t;
+	}
+	
+	process_rows(&jobs[0]);
+	
+	for(int t = started+1; t < threads; t++) // thread creation failed
+		process_rows(&jobs[t]);
+	
+	for(int t = 1; t <= started; t++)
+		pthread_join(tids[t], NULL);
+	
+	delete[] tids;
+}
+
+static inline bool connected(const PointCloud &cloud, int32_t a, int32_t b, int32_t c, float maxstep) {
+	float za = cloud.coord(a, 2), zb = cloud.coord(b, 2), zc = cloud.coord(c, 2);
+	float lo = za, hi = za;
+	
+	if(zb < lo) lo = zb;
+	if(zb > hi) hi = zb;
+	if(zc < lo) lo = zc;
+	if(zc > hi) hi = zc;
+	
+	return hi-lo <= maxstep;
+}
+
+// splits every 2x2 block of pixels into two triangles and keeps those whose
+// corners are all points at most maxstep apart in depth. returns their
+// number and, unless faces is NULL, writes them there.
+static int triangulate(const int32_t *index, int w, int h, const PointCloud &cloud, float maxstep, int32_t *faces) {
+	int n = 0;
+	
+	for(int y = 0; y+1 < h; y++) {
+		const int32_t *top = index+y*w;
+		const int32_t *bottom = top+w;
 		
-		printf("\r%.1f%%", y/(float)(raw.dresy-1)*100.0);
+		for(int x = 0; x+1 < w; x++) {
+			int32_t tl = top[x], tr = top[x+1];
+			int32_t bl = bottom[x], br = bottom[x+1];
+			
+			// counter-clockwise as seen from the sensor, so the normals face it.
+			if(tl >= 0 && tr >= 0 && bl >= 0 && connected(cloud, tl, tr, bl, maxstep)) {
+				if(faces != NULL) {
+					faces[3*n] = tl;
+					faces[3*n+1] = tr;
+					faces[3*n+2] = bl;
+				}
+				n++;
+			}
+			
+			if(tr >= 0 && br >= 0 && bl >= 0 && connected(cloud, tr, br, bl, maxstep)) {
+				if(faces != NULL) {
+					faces[3*n] = tr;
+					faces[3*n+1] = br;
+					faces[3*n+2] = bl;
+				}
+				n++;
+			}
+		}
 	}
 	
-	cloud.num = i;
+	return n;
 }
 
-void export_to_ply(char *filename, PointCloud &c) {
-	FILE *f = fopen(filename, "wb");
-	
-	fprintf(f, "ply\n"
-			   "format ascii 1.0\n"
-			   "comment created by rgbdsend\n"
-			   "element vertex %d\n"
-			   "property float32 x\n"
-			   "property float32 y\n"
-			   "property float32 z\n"
-			   "property uint8 red\n"
-			   "property uint8 green\n"
-			   "property uint8 blue\n"
-			   "element face 0\n"
-			   "property list uint8 int32 vertex_indices\n"
-			   "end_header\n", c.num);
-	
-	for(int i = 0; i < c.num; i++)
-		fprintf(f, "%f %f %f %d %d %d\n", c.x[i], c.y[i], c.z[i], c.r[i], c.g[i], c.b[i]);
-	
-	fclose(f);
-}
\ No newline at end of file
+void depth_to_pointcloud(PointCloud &cloud, RawData &raw, RayTable &rays, float maxdepth, float meshstep, int threads) {
+	// at least one job, even for an empty stream.
+	if(threads > raw.dresy)
+		threads = raw.dresy;
+	if(threads < 1)
+		threads = 1;
+	
+	// colors only need to be averaged and looked up once, not per point.
+	average_color(raw);
+	rays.updateColor(raw.dresx, raw.dresy, raw.cresx, raw.cresy);
+	
+	RowJob *jobs = new RowJob[threads];
+	int32_t *index = NULL;
+	
+	if(meshstep > 0.f) {
+		index = new int32_t[raw.dresx*raw.dresy];
+		memset(index, -1, sizeof(int32_t)*raw.dresx*raw.dresy);
+	}
+	
+	for(int t = 0; t < threads; t++) {
+		jobs[t].cloud = &cloud;
+		jobs[t].raw = &raw;
+		jobs[t].rays = &rays;
+		jobs[t].maxdepth = maxdepth;
+		jobs[t].y0 = raw.dresy*t/threads;
+		jobs[t].y1 = raw.dresy*(t+1)/threads;
+		jobs[t].offset = 0;
+		jobs[t].write = false;
+		jobs[t].index = index;
+	}
+	
+	// first pass counts the points per block, so every block knows where to
+	// put its points in the second pass and the order stays the same as in a
+	// single pass over all rows.
+	run_jobs(jobs, threads);
+	
+	int num = 0;
+	for(int t = 0; t < threads; t++) {
+		jobs[t].offset = num;
+		jobs[t].write = true;
+		num += jobs[t].count;
+	}
+	
+	// the cloud only takes the memory the valid points need.
+	cloud.allocate(num);
+	run_jobs(jobs, threads);
+	
+	delete[] jobs;
+	
+	delete[] cloud.faces;
+	cloud.faces = NULL;
+	cloud.numfaces = 0;
+	
+	// the grid is only known here, so faces have to be made now. a pass to
+	// count them keeps the face list as small as it can be.
+	if(index != NULL) {
+		float maxstep = meshstep*1000.f;
+		int n = triangulate(index, raw.dresx, raw.dresy, cloud, maxstep, NULL);
+		
+		cloud.faces = new int32_t[3*n];
+		cloud.numfaces = triangulate(index, raw.dresx, raw.dresy, cloud, maxstep, cloud.faces);
+		
+		delete[] index;
+	}
+}
@@ -1,32 +1,44 @@
 #ifndef POINTCLOUD_H
 #define POINTCLOUD_H
 
-#include <stdint.h>
-
-namespace openni {
-	class VideoStream;
-}
+#include "cloud.h"
 
 class RawData;
+struct StreamInfo;
 
-struct PointCloud {
+// Per column x/z and per row y/z factors of the depth stream's projection.
+// Only rebuilt when the video mode, field of view or cropping changes.
+class RayTable {
 public:
-	PointCloud(int num);
-	~PointCloud();
+	RayTable();
+	~RayTable();
+	
+	void update(const StreamInfo &depth);
+	// fov in radians. the crop window is given in pixels of the full
+	// resolution.
+	void update(int resx, int resy, float hfov, float vfov, int cropx, int cropy, int cropw, int croph);
+	// maps the (cropped) depth pixels to the color pixels of a cw x ch
+	// color stream. done by depth_to_pointcloud.
+	void updateColor(int dw, int dh, int cw, int ch);
 	
-	float *x;
-	float *y;
-	float *z;
+	float *xz;
+	float *yz;
 	
-	uint8_t *r;
-	uint8_t *g;
-	uint8_t *b;
+	int *colx; // per column and per row offsets into interleaved rgb. the
+	int *coly; // color pixel of depth pixel x, y starts at colx[x]+coly[y].
 	
-	int num;
+private:
+	int resx, resy;
+	int cropx, cropy, cropw, croph;
+	float hfov, vfov;
+	
+	int colordw, colordh, colorcw, colorch;
 };
 
-void depth_to_pointcloud(PointCloud &cloud, RawData &raw, openni::VideoStream &depthstrm, openni::VideoStream &clrstrm, float maxdepth);
-
-void export_to_ply(char *filename, PointCloud &c);
+// rays have to be up to date for raw's depth stream. raw.color is filled in
+// here. cloud is sized to the valid points. meshstep > 0 also connects
+// neighbouring pixels to triangles where their depths are at most meshstep
+// meters apart.
+void depth_to_pointcloud(PointCloud &cloud, RawData &raw, RayTable &rays, float maxdepth, float meshstep, int threads);
 
 #endif
\ No newline at end of file
@@ -4,150 +4,610 @@
 #include <cstring>
 #include <cstdlib>
 #include <unistd.h>
-#include <OpenNI.h>
-#include <queue>
+#include <pthread.h>
+#include <dirent.h>
+#include <signal.h>
+#include <sys/signalfd.h>
+#include <vector>
 
 #include "rgbdsend.h"
 #include "capture.h"
 #include "pointcloud.h"
 #include "network.h"
 #include "config.h"
+#include "jobqueue.h"
+#include "thumbnail.h"
+#include "stats.h"
+#include "framesource.h"
+#include "accumulate.h"
 
-bool record_oni(char *tmpfile, int bufsize, openni::VideoStream &depth, openni::VideoStream &color, Config &conf) {
-	openni::Recorder recorder;
-		
+// device is appended if there are several sensors, otherwise it's -1.
+static void capture_name(char *buf, int bufsize, const char *ext, int device) {
 	time_t t = time(NULL);
-	strftime(tmpfile, bufsize, "rgbd_%Y%m%d_%H-%M-%S_", localtime(&t));
-	strncat(tmpfile, getenv("HOSTNAME"), bufsize);
-	strncat(tmpfile, ".oni", bufsize);
-	printf("Starting ONI Capture.\n");
-	depth.start();
-	color.start();
-	openni::Status rc = recorder.create(tmpfile);	
-	if(rc != openni::STATUS_OK) {
-		printf("Error: Failed to open '%s' for writing!\n%s", tmpfile, openni::OpenNI::getExtendedError());
-		return false;
-	}
+	struct tm tm;
+	const char *host = getenv("HOSTNAME");
 	
-	recorder.attach(color);
-	recorder.attach(depth);
-	recorder.start();
+	// capture threads name their files at the same time.
+	localtime_r(&t, &tm);
+	strftime(buf, bufsize, "rgbd_%Y%m%d_%H-%M-%S_", &tm);
+	snprintf(buf+strlen(buf), bufsize-strlen(buf), "%s", host ? host : "");
+	if(device >= 0)
+		snprintf(buf+strlen(buf), bufsize-strlen(buf), "_%d", device);
+	snprintf(buf+strlen(buf), bufsize-strlen(buf), ".%s", ext);
+}
+
+static long elapsed_ms(struct timespec &start) {
+	struct timespec tp;
+	clock_gettime(CLOCK_MONOTONIC, &tp);
+	return (tp.tv_sec-start.tv_sec)*1000+(tp.tv_nsec-start.tv_nsec)/1000000;
+}
+
+bool record_oni(char *tmpfile, int bufsize, FrameSource &source, int device, Config &conf) {
+	capture_name(tmpfile, bufsize, "oni", device);
+	printf("Starting ONI Capture.\n");
 	
-	struct timespec	start, tp;
+	struct timespec	start;
 	clock_gettime(CLOCK_MONOTONIC, &start);
 	
-	long tt;
-	do {
-		usleep(100);
-		clock_gettime(CLOCK_MONOTONIC, &tp);
-		tt = (tp.tv_sec-start.tv_sec)*1000+(tp.tv_nsec-start.tv_nsec)/1000000;
-	} while(tt < conf.capture_time);
-		
+	if(!source.recordOni(tmpfile, conf.capture_time))
+		return false;
 	
-	recorder.stop();
-	color.stop();
-	depth.stop();
-	recorder.destroy();
+	stats_time(STAGE_CAPTURE, start);
 	
 	printf("Captured ONI to '%s'\n", tmpfile);
 	
 	return true;
 }
 
-void oni_to_pointcloud(char *tmpfile, Config &conf) {
-	openni::Device onidev;
-	openni::VideoStream depth, color;
+// counts the frames and depth samples that went into raw and the points
+// they gave.
+static void count_capture(RawData &raw, PointCloud &cloud) {
+	long long accepted = 0;
 	
-	if(!init_openni_device(tmpfile, &onidev, &depth, &color)) {
-		return;
+	for(int i = 0; i < raw.dresx*raw.dresy; i++)
+		accepted += raw.dframenums[i];
+	
+	stats_add(STAT_CAPTURES, 1);
+	stats_add(STAT_FRAMES_ACCEPTED, raw.dframenum+raw.cframenum);
+	stats_add(STAT_SAMPLES_ACCEPTED, accepted);
+	stats_add(STAT_SAMPLES_REJECTED, (long long)raw.dframenum*raw.dresx*raw.dresy-accepted);
+	stats_add(STAT_POINTS, cloud.num);
+}
+
+// converts raw, which was accumulated from the depth stream depth.
+static PointCloud *raw_to_pointcloud(RawData &raw, StreamInfo &depth, RayTable &rays, Config &conf, int threads) {
+	struct timespec start;
+	clock_gettime(CLOCK_MONOTONIC, &start);
+	
+	PointCloud *cloud = new PointCloud(0, conf.capture_quantize != 0);
+	rays.update(depth);
+	depth_to_pointcloud(*cloud, raw, rays, conf.capture_max_depth, conf.capture_mesh_step, threads);
+	
+	stats_time(STAGE_CLOUD, start);
+	count_capture(raw, *cloud);
+	
+	return cloud;
+}
+
+// accumulates frames from source for capture_time. converting them is left
+// to the worker, so the daemon doesn't wait for it. the frames come from pool
+// and the capture fails if the worker doesn't give any back within
+// capture_time.
+CaptureFrames *capture_direct(char *filename, int bufsize, FrameSource &source, int device, FramePool &pool, Config &conf) {
+	CaptureFrames *frames = pool.take(conf.capture_time);
+	if(frames == NULL) {
+		printf("Capture Error: No free frame buffers. Too many captures are waiting to be processed.\n");
+		return NULL;
 	}
-		
-	int fnlen = strlen(tmpfile);
-	tmpfile[fnlen-3] = 'p';
-	tmpfile[fnlen-2] = 'l';
-	tmpfile[fnlen-1] = 'y';
 	
-	onidev.getPlaybackControl()->setRepeatEnabled(false);
+	StreamInfo color = source.info(SOURCE_COLOR);
 	
-	int dw, dh, cw, ch;
-	int tmp1, tmp2;
+	frames->depth = source.info(SOURCE_DEPTH);
+	frames->device = device;
 	
-	if(!depth.getCropping(&tmp1, &tmp2, &dw, &dh)) {
-		dw = depth.getVideoMode().getResolutionX();
-		dh = depth.getVideoMode().getResolutionY();
+	capture_name(filename, bufsize, cloud_extension(conf.capture_format), device);
+	printf("Starting direct capture.\n");
+	
+	struct timespec start;
+	clock_gettime(CLOCK_MONOTONIC, &start);
+	
+	frames->raw.reset(frames->depth.cropw, frames->depth.croph, color.cropw, color.croph);
+	if(!capture_live(source, frames->raw, conf.capture_time)) {
+		pool.give(frames);
+		return NULL;
 	}
 	
-	if(!color.getCropping(&tmp1, &tmp2, &cw, &ch)) {
-		cw = color.getVideoMode().getResolutionX();
-		ch = color.getVideoMode().getResolutionY();
+	stats_time(STAGE_CAPTURE, start);
+	
+	return frames;
+}
+
+PointCloud *oni_to_pointcloud(char *onifile, RawData &raw, RayTable &rays, Config &conf, int threads) {
+	OpenNISource oni;
+	PointCloud *cloud = NULL;
+	
+	if(!oni.open(onifile, NULL)) {
+		return NULL;
 	}
 	
-	RawData raw(dw, dh, cw, ch);
-			
-// 	printf("Recording started.\n");
+	StreamInfo depth = oni.info(SOURCE_DEPTH);
+	StreamInfo color = oni.info(SOURCE_COLOR);
 	
-	openni::VideoStream* streams[] = {&depth, &color};
-	int framecounts[] = {onidev.getPlaybackControl()->getNumberOfFrames(depth),
-						 onidev.getPlaybackControl()->getNumberOfFrames(color)};
+	raw.reset(depth.cropw, depth.croph, color.cropw, color.croph);
+	
+	int framecounts[] = {oni.frameCount(SOURCE_DEPTH), oni.frameCount(SOURCE_COLOR)};
+	printf("ONI contains %d depth and %d color frames\n", framecounts[0], framecounts[1]);
 						 
 	if(framecounts[0] == 0 && framecounts[1] == 0) {
 		printf("Error: ONI didn't contain any frames.\n");
 	} else {
-		capture(streams, 2, raw, framecounts);
-			
-	// 	printf("Recording ended.\n");
-			
-		PointCloud cloud(raw.dresx*raw.dresy);
-		depth_to_pointcloud(cloud, raw, depth, color, conf.capture_max_depth);
-		export_to_ply(tmpfile, cloud);
+		struct timespec start;
+		clock_gettime(CLOCK_MONOTONIC, &start);
+		
+		capture(oni, raw);
+		
+		stats_time(STAGE_REPLAY, start);
 		
-		printf("\nExtracted to point cloud: %s\n", tmpfile);
+		cloud = raw_to_pointcloud(raw, depth, rays, conf, threads);
+		
+		printf("\nExtracted point cloud from '%s'\n", onifile);
 	}
-	depth.destroy();
-	color.destroy();
-	onidev.close();
+	
+	return cloud;
+}
+
+static void set_extension(char *filename, const char *ext) {
+	char *p = strrchr(filename, '.');
+	strcpy(p+1, ext);
 }
 
-void process_onis(std::queue<char *> &filelist, CURL *curl, Config &conf) {
-	printf("Started processing captured onis...\n");
+// converts the frames of a direct capture. the clouds of several sensors are
+// moved by their poses and merged.
+static PointCloud *frames_to_pointcloud(CaptureFrames *frames, RayTable &rays, Config &conf) {
+	int n = 0;
+	for(CaptureFrames *f = frames; f != NULL; f = f->next)
+		n++;
 	
-	while(!filelist.empty()) {
-		printf("%s\n", filelist.front());
-		oni_to_pointcloud(filelist.front(), conf);		
+	if(n == 1)
+		return raw_to_pointcloud(frames->raw, frames->depth, rays, conf, conf.capture_threads);
+	
+	PointCloud **parts = new PointCloud*[n];
+	int m = 0;
+	for(CaptureFrames *f = frames; f != NULL; f = f->next) {
+		PointCloud *part = raw_to_pointcloud(f->raw, f->depth, rays, conf, conf.capture_threads);
+		
+		if(f->device < CONF_MAX_SENSORS && conf.source_pose[f->device].set)
+			transform_cloud(*part, conf.source_pose[f->device]);
+		else if(f->device != 0) // the first sensor's frame is fine without one
+			printf("Config Warning: No pose for sensor %d. Merging its points as they are.\n", f->device);
+		
+		parts[m++] = part;
+	}
+	
+	PointCloud *cloud = merge_clouds(parts, n);
+	printf("Merged %d point clouds.\n", n);
+	
+	for(int i = 0; i < n; i++)
+		delete parts[i];
+	delete[] parts;
+	
+	return cloud;
+}
+
+void process_capture(CaptureJob &job, RawData &raw, RayTable &rays, Uploader &uploader, CloudMailbox &latest, Config &conf) {
+	char *file = job.filename;
+	PointCloud *cloud;
+	printf("Processing %s\n", file);
+	
+	if(job.frames != NULL) {
+		cloud = frames_to_pointcloud(job.frames, rays, conf);
+		printf("Captured point cloud '%s'\n", file);
+	} else {
+		cloud = oni_to_pointcloud(file, raw, rays, conf, conf.capture_threads);
+		remove(file);
+		set_extension(file, cloud_extension(conf.capture_format));
+	}
+	
+	if(cloud != NULL) {
+		bool dest = conf.dest_url && conf.dest_username && conf.dest_password;
+		
+		if(conf.capture_voxel_size > 0.f)
+			voxel_downsample(*cloud, conf.capture_voxel_size*1000.f);
+		
+		// the uploader owns file from here on and saves the cloud to disk if
+		// the upload fails for good. the client shares the cloud and gets it
+		// right away rather than after the upload and its retries.
+		if(dest && conf.dest_stream) {
+			retain_cloud(cloud);
+			latest.put(cloud, job.capture, job.parts);
+			uploader.sendCloud(cloud, conf.capture_format, file);
+			return;
+		}
 		
-		if(conf.dest_url && conf.dest_username && conf.dest_password)
-			send_file(curl, filelist.front(), conf.dest_url, conf.dest_username, conf.dest_password);
-		else
+		struct timespec start;
+		clock_gettime(CLOCK_MONOTONIC, &start);
+		
+		export_cloud(file, *cloud, conf.capture_format);
+		printf("Exported point cloud to '%s'\n", file);
+		
+		stats_time(STAGE_EXPORT, start);
+		
+		if(dest) {
+			uploader.sendFile(file);
+			file = NULL;
+		} else {
 			printf("No destination server specified. Skipping transfer.\n");
+		}
 		
-		char *p = strrchr(filelist.front(), '.');
-		p[1] = 'o';
-		p[2] = 'n';
-		p[3] = 'i';
+		latest.put(cloud, job.capture, job.parts); // for the client to pick up with getc
+	} else {
+		latest.put(NULL, job.capture, job.parts); // the other sensors' clouds are still sent
+	}
+	
+	delete[] file;
+}
+
+struct Worker {
+	JobQueue *jobs;
+	CloudMailbox *latest;
+	Uploader *uploader;
+	FramePool *pool; // takes back the frames of direct captures
+	Config *conf;
+	pthread_mutex_t *conflock; // held while conf is reloaded
+};
+
+// converts captures in the background and queues them for upload, so the
+// daemon stays responsive.
+static void *process_thread(void *arg) {
+	Worker *w = (Worker *)arg;
+	RawData raw; // for ONI captures. direct captures bring their own
+	RayTable rays;
+	CaptureJob job;
+	
+	while(w->jobs->pop(&job)) {
+		pthread_mutex_lock(w->conflock);
+		Config conf(*w->conf);
+		pthread_mutex_unlock(w->conflock);
 		
-		remove(filelist.front());
+		process_capture(job, raw, rays, *w->uploader, *w->latest, conf);
+		if(job.frames != NULL)
+			w->pool->give(job.frames);
+		printf("Done processing. %d captures left, %d uploads pending.\n", w->jobs->size(), w->uploader->size());
+	}
+	
+	return NULL;
+}
+
+struct BatchWorker {
+	JobQueue *jobs;
+	Config *conf;
+	int threads; // for each file
+	int failed;
+};
+
+// converts an ONI next to it, with the current max_depth, voxel size and
+// format. the ONI is kept.
+static bool convert_oni(char *onifile, RawData &raw, RayTable &rays, Config &conf, int threads) {
+	PointCloud *cloud = oni_to_pointcloud(onifile, raw, rays, conf, threads);
+	if(cloud == NULL)
+		return false;
+	
+	if(conf.capture_voxel_size > 0.f)
+		voxel_downsample(*cloud, conf.capture_voxel_size*1000.f);
+	
+	const char *ext = cloud_extension(conf.capture_format);
+	char *file = new char[strlen(onifile)+strlen(ext)+1];
+	strcpy(file, onifile);
+	set_extension(file, ext);
+	
+	struct timespec start;
+	clock_gettime(CLOCK_MONOTONIC, &start);
+	
+	export_cloud(file, *cloud, conf.capture_format);
+	printf("Exported point cloud to '%s'\n", file);
+	
+	stats_time(STAGE_EXPORT, start);
+	
+	delete[] file;
+	delete cloud;
+	
+	return true;
+}
+
+static void *batch_thread(void *arg) {
+	BatchWorker *w = (BatchWorker *)arg;
+	RawData raw;
+	RayTable rays;
+	CaptureJob job;
+	
+	while(w->jobs->pop(&job)) {
+		if(!convert_oni(job.filename, raw, rays, *w->conf, w->threads))
+			__sync_fetch_and_add(&w->failed, 1);
+		delete[] job.filename;
+	}
+	
+	return NULL;
+}
+
+static int oni_filter(const struct dirent *e) {
+	const char *ext = strrchr(e->d_name, '.');
+	return ext != NULL && strcmp(ext, ".oni") == 0;
+}
+
+// converts every ONI in dir to a cloud, jobs files at a time. the capture
+// threads are split between them. returns the number of files that failed.
+static int run_batch(const char *dir, int jobs, Config &conf) {
+	struct dirent **names;
+	int n = scandir(dir, &names, oni_filter, alphasort);
+	
+	if(n < 0) {
+		printf("Error: Couldn't read '%s': %s\n", dir, strerror(errno));
+		return -1;
+	}
+	
+	if(jobs > n)
+		jobs = n;
+	if(jobs < 1)
+		jobs = 1;
+	
+	// once, before the threads open their files
+	if(!init_openni())
+		return -1;
+	
+	JobQueue queue;
+	for(int i = 0; i < n; i++) {
+		CaptureJob job;
+		job.filename = new char[strlen(dir)+strlen(names[i]->d_name)+2];
+		sprintf(job.filename, "%s/%s", dir, names[i]->d_name);
+		job.frames = NULL;
+		job.capture = i;
+		job.parts = 1;
+		queue.push(job);
+		free(names[i]);
+	}
+	free(names);
+	queue.close();
+	
+	printf("Converting %d ONI files in '%s', %d at a time.\n", n, dir, jobs);
+	
+	struct timespec start;
+	clock_gettime(CLOCK_MONOTONIC, &start);
+	
+	BatchWorker worker = {&queue, &conf, conf.capture_threads/jobs > 1 ? conf.capture_threads/jobs : 1, 0};
+	pthread_t *tids = new pthread_t[jobs];
+	int started = 0;
+	
+	for(; started < jobs; started++) {
+		int rc = pthread_create(&tids[started], NULL, batch_thread, &worker);
+		if(rc != 0) {
+			printf("Error: Couldn't start conversion thread: %s\n", strerror(rc));
+			break;
+		}
+	}
+	
+	if(started == 0) // do it on this thread then
+		batch_thread(&worker);
+	
+	for(int i = 0; i < started; i++)
+		pthread_join(tids[i], NULL);
+	delete[] tids;
+	
+	printf("Converted %d of %d ONI files in %ld ms.\n", n-worker.failed, n, elapsed_ms(start));
+	
+	cleanup_openni();
+	
+	return worker.failed;
+}
+
+// A sensor and its part of the running capture. Captures from several
+// sensors run on a thread each.
+struct Sensor {
+	FrameSource *source;
+	int device; // -1 if it's the only one
+	FramePool *pool;
+	
+	Config conf; // for the running capture
+	CaptureJob job;
+	bool ok;
+};
+
+static void *capture_thread(void *arg) {
+	Sensor *s = (Sensor *)arg;
+	
+	s->job.filename = new char[rgbdsend::filename_bufsize];
+	s->job.frames = NULL;
+	
+	if(s->conf.capture_mode == CAPTURE_MODE_DIRECT) {
+		s->job.frames = capture_direct(s->job.filename, rgbdsend::filename_bufsize, *s->source, s->device, *s->pool, s->conf);
+		s->ok = s->job.frames != NULL;
+	} else {
+		s->ok = record_oni(s->job.filename, rgbdsend::filename_bufsize, *s->source, s->device, s->conf);
+	}
+	
+	if(!s->ok)
+		delete[] s->job.filename;
+	
+	return NULL;
+}
+
+// captures from all n sensors at the same time and queues the captures, or
+// one job whose cloud merges them. capture numbers the jobs. returns false if
+// none succeeded.
+static bool capture_all(Sensor *sensors, int n, int capture, JobQueue &jobs, Config &conf) {
+	pthread_t *tids = new pthread_t[n];
+	int started = 0;
+	int ok = 0;
+	
+	for(int i = 0; i < n; i++) {
+		sensors[i].conf = conf;
+		sensors[i].job.capture = capture;
+	}
+	
+	// the calling thread takes the first sensor itself.
+	for(int i = 1; i < n; i++) {
+		if(pthread_create(&tids[i], NULL, capture_thread, &sensors[i]) != 0)
+			break;
+		started = i;
+	}
+	
+	capture_thread(&sensors[0]);
+	
+	for(int i = started+1; i < n; i++) // thread creation failed
+		capture_thread(&sensors[i]);
+	
+	for(int i = 1; i <= started; i++)
+		pthread_join(tids[i], NULL);
+	
+	delete[] tids;
+	
+	for(int i = 0; i < n; i++)
+		ok += sensors[i].ok;
+	
+	if(n > 1 && ok > 0 && conf.capture_merge && conf.capture_mode == CAPTURE_MODE_DIRECT) {
+		// the worker merges the frames of a list into one cloud.
+		CaptureJob job;
+		job.filename = new char[rgbdsend::filename_bufsize];
+		capture_name(job.filename, rgbdsend::filename_bufsize, cloud_extension(conf.capture_format), -1);
+		job.frames = NULL;
+		job.capture = capture;
+		job.parts = 1;
+		
+		for(int i = n-1; i >= 0; i--) {
+			if(!sensors[i].ok)
+				continue;
+			sensors[i].job.frames->next = job.frames;
+			job.frames = sensors[i].job.frames;
+			delete[] sensors[i].job.filename;
+		}
 		
-		delete[] filelist.front();
-		filelist.pop();
+		jobs.push(job);
+	} else {
+		for(int i = 0; i < n; i++) {
+			if(sensors[i].ok) {
+				sensors[i].job.parts = ok;
+				jobs.push(sensors[i].job);
+			}
+		}
+	}
+	
+	return ok > 0;
+}
+
+static void check_capture_mode(Config &conf) {
+	if(conf.capture_mode == CAPTURE_MODE_ONI && conf.source_type != SOURCE_TYPE_OPENNI) {
+		printf("Config Warning: ONI capture needs the openni source. Capturing directly.\n");
+		conf.capture_mode = CAPTURE_MODE_DIRECT;
+	}
+}
+
+// re-reads the config file and applies it without reopening the sources.
+// cropping changes right away, everything else with the next capture or
+// upload. if the file can't be read, the settings stay as they are.
+static bool reload_config(char *cfgfile, Config &conf, pthread_mutex_t &conflock, std::vector<FrameSource *> &sources,
+						  Thumbnailer &thumbnailer, Uploader &uploader, Daemon &daemon) {
+	Config next;
+	
+	if(next.read(cfgfile) != 1) {
+		printf("Config Error: Couldn't reload '%s'. Keeping the current settings.\n", cfgfile);
+		return false;
+	}
+	
+	// the sources were opened and the socket bound with these, so they keep
+	// the values they were started with.
+	if(next.source_type != conf.source_type || next.source_width != conf.source_width
+		|| next.source_height != conf.source_height || next.source_fps != conf.source_fps
+		|| next.source_count != conf.source_count || next.source_noise != conf.source_noise
+		|| next.source_invalid != conf.source_invalid
+		|| (next.source_uri == NULL) != (conf.source_uri == NULL)
+		|| (next.source_uri != NULL && strcmp(next.source_uri, conf.source_uri) != 0))
+		printf("Config Warning: Changes to the source take effect after a restart.\n");
+	if(next.daemon_port != conf.daemon_port)
+		printf("Config Warning: A new port takes effect after a restart.\n");
+	next.source_type = conf.source_type;
+	next.source_width = conf.source_width;
+	next.source_height = conf.source_height;
+	next.source_fps = conf.source_fps;
+	next.source_count = conf.source_count;
+	next.source_noise = conf.source_noise;
+	next.source_invalid = conf.source_invalid;
+	delete[] next.source_uri;
+	next.source_uri = NULL;
+	if(conf.source_uri != NULL) {
+		next.source_uri = new char[strlen(conf.source_uri)+1];
+		strcpy(next.source_uri, conf.source_uri);
+	}
+	next.daemon_port = conf.daemon_port;
+	check_capture_mode(next);
+	
+	if(next.crop_left != conf.crop_left || next.crop_right != conf.crop_right
+		|| next.crop_top != conf.crop_top || next.crop_bottom != conf.crop_bottom) {
+		bool cropped = true;
+		for(size_t i = 0; i < sources.size() && cropped; i++)
+			cropped = sources[i]->setCropping(next);
+		
+		if(cropped) {
+			StreamInfo depth = sources[0]->info(SOURCE_DEPTH);
+			printf("Cropped depth to %dx%d+%d+%d.\n", depth.cropw, depth.croph, depth.cropx, depth.cropy);
+		} else {
+			printf("Config Error: Keeping the current cropping.\n");
+			// some streams may be cropped already
+			for(size_t i = 0; i < sources.size() && conf.source_type == SOURCE_TYPE_OPENNI; i++)
+				sources[i]->setCropping(conf);
+			next.crop_left = conf.crop_left;
+			next.crop_right = conf.crop_right;
+			next.crop_top = conf.crop_top;
+			next.crop_bottom = conf.crop_bottom;
+		}
 	}
 	
-	printf("Done processing.\n");
+	pthread_mutex_lock(&conflock);
+	conf = next;
+	pthread_mutex_unlock(&conflock);
+	
+	thumbnailer.setup(conf.thumb_scale, conf.thumb_quality, conf.thumb_cache_time);
+	uploader.configure(conf);
+	daemon.timeout = conf.daemon_timeout;
+	
+	printf("Reloaded '%s'.\n", cfgfile);
+	
+	return true;
 }
 
-static openni::Device __device; // have to be global to be reachable by atexit().
-static openni::VideoStream __depth, __color;
+static std::vector<FrameSource *> __sources; // has to be global to be reachable by atexit().
 
 static void atexit_handler() {
 	printf("Closing devices.\n");
-	cleanup_openni(__device, __depth, __color);
+	for(size_t i = 0; i < __sources.size(); i++)
+		delete __sources[i];
+	cleanup_openni();
 	printf("Terminating.\n");
 }
 
+static void usage(const char *name) {
+	printf("usage: %s [-b directory [-j files]]\n"
+		   "  -b  convert every ONI file in directory to a point cloud and exit\n"
+		   "  -j  number of files converted at the same time with -b\n", name);
+}
+
 int main(int argc, char **argv) {
-	openni::Device &device = __device;
-	openni::VideoStream &depth = __depth, &color = __color;
-	openni::Status rc;
-		
+	const char *batchdir = NULL;
+	int batchjobs = sysconf(_SC_NPROCESSORS_ONLN);
+	int c;
+	
+	while((c = getopt(argc, argv, "b:j:")) != -1) {
+		switch(c) {
+		case 'b':
+			batchdir = optarg;
+			break;
+		case 'j':
+			batchjobs = atoi(optarg);
+			break;
+		default:
+			usage(argv[0]);
+			return 1;
+		}
+	}
+	
 	char *prefix = strrchr(argv[0], '/')+1;
 	char *cfgfile = new char[prefix-argv[0]+strlen(rgbdsend::config_file_name)+1];
 	
@@ -159,102 +619,198 @@ int main(int argc, char **argv) {
 		printf("Config: Falling back to builtin presets.\n");
 		conf.setDefaults();
 	}
+	
+	if(batchdir != NULL) {
+		delete[] cfgfile;
+		return run_batch(batchdir, batchjobs, conf) == 0 ? 0 : 1;
+	}
+	
+	// SIGHUP reloads the config. it's taken from a signalfd, so it has to be
+	// blocked before any thread, OpenNI's included, is started.
+	sigset_t hup;
+	sigemptyset(&hup);
+	sigaddset(&hup, SIGHUP);
+	pthread_sigmask(SIG_BLOCK, &hup, NULL);
+	int hupfd = signalfd(-1, &hup, SFD_NONBLOCK | SFD_CLOEXEC);
 		
-	delete[] cfgfile;
-		
-	CURL *curl = init_curl();
+	init_curl();
 	
 	Daemon daemon;
 	daemon.init(conf.daemon_port, conf.daemon_timeout);
 		
 	atexit(atexit_handler);
 	
-	init_openni(&device, &depth, &color, conf);
+	if(!open_frame_sources(conf, __sources))
+		exit(1);
 	
-	int dw, dh, cw, ch;
-	int tmp1, tmp2;
+	int nsensors = __sources.size();
+	Sensor *sensors = new Sensor[nsensors];
+	FramePool pool(nsensors*rgbdsend::frames_per_sensor);
 	
-	if(!depth.getCropping(&tmp1, &tmp2, &dw, &dh)) {
-		dw = depth.getVideoMode().getResolutionX();
-		dh = depth.getVideoMode().getResolutionY();
+	for(int i = 0; i < nsensors; i++) {
+		StreamInfo depth = __sources[i]->info(SOURCE_DEPTH);
+		StreamInfo color = __sources[i]->info(SOURCE_COLOR);
+		
+		printf("Resolution of device %d:\nDepth: %dx%d @ %d fps\nColor: %dx%d @ %d fps\n", i,
+			   depth.cropw, depth.croph, depth.fps,
+			   color.cropw, color.croph, color.fps);
+		
+		sensors[i].source = __sources[i];
+		sensors[i].device = nsensors > 1 ? i : -1;
+		sensors[i].pool = &pool;
 	}
+	printf("Depth accumulation: %s\n", accumulate_depth_impl());
 	
-	if(!color.getCropping(&tmp1, &tmp2, &cw, &ch)) {
-		cw = color.getVideoMode().getResolutionX();
-		ch = color.getVideoMode().getResolutionY();
-	}
+	// thumbnails and the preview come from the first sensor.
+	FrameSource &source = *__sources[0];
+	
+	check_capture_mode(conf);
+	
+	JobQueue jobs;
 	
-	printf("Resolution:\nDepth: %dx%d @ %d fps\nColor: %dx%d @ %d fps\n",
-		   dw, dh, depth.getVideoMode().getFps(),
-		   cw, ch, color.getVideoMode().getFps());
+	Thumbnailer thumbnailer;
+	thumbnailer.setup(conf.thumb_scale, conf.thumb_quality, conf.thumb_cache_time);
 	
-	std::queue<char *> onilist;
+	CloudMailbox latest;
+	daemon.watch(latest.fd());
+	daemon.watch(hupfd);
+	
+	Uploader uploader;
+	uploader.start(conf);
+	
+	pthread_mutex_t conflock;
+	pthread_mutex_init(&conflock, NULL);
+	
+	Worker worker = {&jobs, &latest, &uploader, &pool, &conf, &conflock};
+	pthread_t workertid;
+	int rc = pthread_create(&workertid, NULL, process_thread, &worker);
+	if(rc != 0) {
+		printf("Error: Couldn't start processing thread: %s\n", strerror(rc));
+		exit(1);
+	}
+	
+	bool preview = false;
+	bool cloudrequest = false;
+	int captures = 0;
+	struct timespec lastpreview;
+	clock_gettime(CLOCK_MONOTONIC, &lastpreview);
 	
 	Command cmd;
 	while(1) {
-		timeval t;
-		t.tv_sec = conf.daemon_timeout;
-		t.tv_usec = 0;
+		long previewinterval = 1000/(conf.thumb_preview_fps > 0 ? conf.thumb_preview_fps : 1);
 		
-		fd_set fds;
-		FD_ZERO(&fds);
-		FD_SET(daemon.sock, &fds);
-		FD_SET(daemon.csock, &fds);
-		
-		int in = select((daemon.csock > daemon.sock ? daemon.csock : daemon.sock)+1, &fds, 0, 0, &t);
-				
-		if(FD_ISSET(daemon.sock, &fds))
-			daemon.acceptConnection();
+		// without a preview running, sleep until something happens.
+		long wait = -1;
+		if(preview) {
+			wait = previewinterval-elapsed_ms(lastpreview);
+			if(wait < 0)
+				wait = 0;
+		}
 		
-		if(FD_ISSET(daemon.csock, &fds)) {
-			char b[5];
-			int r = daemon.receiveCommand(&cmd);
-			
-			if(r == 0) {
-				printf("Daemon Error: Could not receive command.\n");
-				
-				daemon.closeConnection();
-				continue;
-			}
-			
-			if(r == 2) // keep alive
-				continue;			
-									
+		if(daemon.waitCommand(&cmd, wait)) {
 			if(strncmp(cmd.header, "capt", 4) == 0) {
 				printf("Received capture command.\n");
 				
-				char *newfile = new char[rgbdsend::filename_bufsize];
-				if(record_oni(newfile, rgbdsend::filename_bufsize, depth, color, conf) == true) {
-					onilist.push(newfile);
-				} else {
-					delete[] newfile;
-				}
-				daemon.sendCommand("okay", 0, 0);
+				bool ok = capture_all(sensors, nsensors, captures++, jobs, conf);
+				
+				if(thumbnailer.isLive()) // capturing stops the color stream
+					source.start(SOURCE_COLOR);
+				
+				daemon.sendCommand(ok ? "okay" : "fail", 0, 0);
 			} else if(strncmp(cmd.header, "thmb", 4) == 0) {
 				printf("Received thumbnail command.\n");
-				unsigned char *thumbbuf = NULL;
-				long unsigned int size = 0;
-				capture_thumbnail(&thumbbuf, &size, color);
-				printf("Captured thumbnail. %ld bytes\n", size);
-				
-				daemon.sendCommand("stmb", thumbbuf, size);
+				const unsigned char *thumbbuf = NULL;
+				unsigned long size = 0;
+				struct timespec start;
+				clock_gettime(CLOCK_MONOTONIC, &start);
 				
-//				delete[] thumbbuf; seems like libjpeg handles this. but I'm not sure.
+				if(thumbnailer.get(source, &thumbbuf, &size)) {
+					stats_time(STAGE_THUMBNAIL, start);
+					printf("Captured thumbnail. %ld bytes\n", size);
+					daemon.sendCommand("stmb", (void *)thumbbuf, size);
+				} else {
+					daemon.sendCommand("fail", 0, 0);
+				}
+			} else if(strncmp(cmd.header, "prev", 4) == 0) {
+				printf("Received preview command.\n");
+				thumbnailer.startLive(source);
+				preview = true;
+				daemon.sendCommand("okay", 0, 0);
+			} else if(strncmp(cmd.header, "stop", 4) == 0) {
+				thumbnailer.stopLive(source);
+				preview = false;
+				daemon.sendCommand("okay", 0, 0);
+			} else if(strncmp(cmd.header, "getc", 4) == 0) {
+				printf("Received cloud request.\n");
+				cloudrequest = true; // answered as soon as a cloud is ready
+			} else if(strncmp(cmd.header, "stat", 4) == 0) {
+				int len = stats_format(NULL, 0);
+				char *buf = new char[len+1];
+				stats_format(buf, len+1);
+				daemon.sendCommand("stts", buf, len);
+				delete[] buf;
+			} else if(strncmp(cmd.header, "rcfg", 4) == 0) {
+				printf("Received reload command.\n");
+				bool ok = reload_config(cfgfile, conf, conflock, __sources, thumbnailer, uploader, daemon);
+				daemon.sendCommand(ok ? "okay" : "fail", 0, 0);
 			} else if(strncmp(cmd.header, "quit", 4) == 0) {
 				daemon.closeConnection();
 			} else {
 				printf("Daemon Error: Received undefined command.\n");
 			}
 		}
-				
-		if(daemon.csock != -1 && in <= 0) {
-			daemon.closeConnection();			
+		
+		struct signalfd_siginfo si;
+		bool hangup = false;
+		while(read(hupfd, &si, sizeof(si)) == sizeof(si))
+			hangup = true;
+		
+		if(hangup) {
+			printf("Received SIGHUP.\n");
+			reload_config(cfgfile, conf, conflock, __sources, thumbnailer, uploader, daemon);
 		}
 		
-		if(daemon.csock == -1 && !onilist.empty())
-			process_onis(onilist, curl, conf);
-	}
+		if(preview && daemon.csock == -1) {
+			thumbnailer.stopLive(source);
+			preview = false;
+		}
 		
-	cleanup_curl(curl);
-	cleanup_openni(device, depth, color);
+		if(daemon.csock == -1)
+			cloudrequest = false;
+		
+		if(cloudrequest) {
+			std::vector<PointCloud *> clouds;
+			if(latest.take(clouds)) {
+				daemon.sendClouds(clouds, conf.capture_format);
+				cloudrequest = false;
+			}
+		}
+		
+		if(preview && elapsed_ms(lastpreview) >= previewinterval) {
+			const unsigned char *thumbbuf = NULL;
+			unsigned long size = 0;
+			
+			struct timespec start;
+			clock_gettime(CLOCK_MONOTONIC, &start);
+			
+			// frames the client can't take right now are dropped.
+			if(thumbnailer.getLive(source, &thumbbuf, &size)) {
+				stats_time(STAGE_THUMBNAIL, start);
+				if(daemon.canSend(size))
+					daemon.sendCommand("stmb", (void *)thumbbuf, size);
+			}
+			
+			clock_gettime(CLOCK_MONOTONIC, &lastpreview);
+		}
+	}
+	
+	jobs.close();
+	pthread_join(workertid, NULL);
+	uploader.finish();
+	
+	cleanup_curl();
+	pthread_mutex_destroy(&conflock);
+	close(hupfd);
+	delete[] sensors;
+	delete[] cfgfile;
 }
@@ -7,6 +7,8 @@ namespace rgbdsend {
 	
 	const int read_wait_timeout = 20000;	
 	const int depth_averaging_threshold = 300;	
+	const int cloud_chunk_size = 1<<16;
+	const int frames_per_sensor = 3; // direct captures converted or waiting
 }
 
 #endif
@@ -0,0 +1,96 @@
+#include <cstdio>
+#include <cstdarg>
+#include <stdint.h>
+
+#include "stats.h"
+
+// upper bucket bounds in milliseconds. the last bucket takes everything
+// above.
+static const int bucket_ms[] = {1, 2, 5, 10, 20, 50, 100, 200, 500, 1000, 2000, 5000, 10000, 30000, 60000};
+
+enum {
+	STAT_BUCKETS = sizeof(bucket_ms)/sizeof(bucket_ms[0])+1
+};
+
+static const char *const stage_names[STAGE_COUNT] = {
+	"capture", "replay", "cloud", "export", "upload", "thumbnail"
+};
+
+static const char *const counter_names[STAT_COUNTER_COUNT] = {
+	"captures", "frames_accepted", "frames_rejected", "read_timeouts",
+	"samples_accepted", "samples_rejected", "points",
+	"uploads", "uploads_failed", "bytes_uploaded"
+};
+
+struct Histogram {
+	int64_t buckets[STAT_BUCKETS];
+	int64_t count;
+	int64_t sum_us;
+};
+
+static Histogram stages[STAGE_COUNT];
+static int64_t counters[STAT_COUNTER_COUNT];
+
+void stats_time(int stage, struct timespec &start) {
+	struct timespec tp;
+	clock_gettime(CLOCK_MONOTONIC, &tp);
+	int64_t us = (tp.tv_sec-start.tv_sec)*1000000LL+(tp.tv_nsec-start.tv_nsec)/1000;
+	
+	int b = 0;
+	while(b < STAT_BUCKETS-1 && us > bucket_ms[b]*1000LL)
+		b++;
+	
+	Histogram &h = stages[stage];
+	__sync_fetch_and_add(&h.buckets[b], 1);
+	__sync_fetch_and_add(&h.count, 1);
+	__sync_fetch_and_add(&h.sum_us, us);
+}
+
+void stats_add(int counter, long long value) {
+	__sync_fetch_and_add(&counters[counter], value);
+}
+
+// appends to buf like snprintf, but keeps counting once it's full.
+static int append(char *buf, int size, int len, const char *fmt, ...) {
+	int space = len < size ? size-len : 0;
+	va_list ap;
+	
+	va_start(ap, fmt);
+	len += vsnprintf(space > 0 ? buf+len : NULL, space, fmt, ap);
+	va_end(ap);
+	
+	return len;
+}
+
+int stats_format(char *buf, int size) {
+	int len = 0;
+	char le[16];
+	
+	len = append(buf, size, len, "# TYPE rgbdsend_stage_ms histogram\n");
+	
+	for(int s = 0; s < STAGE_COUNT; s++) {
+		Histogram &h = stages[s];
+		long long cumulative = 0;
+		
+		for(int b = 0; b < STAT_BUCKETS; b++) {
+			cumulative += h.buckets[b];
+			
+			if(b < STAT_BUCKETS-1)
+				snprintf(le, sizeof(le), "%d", bucket_ms[b]);
+			else
+				snprintf(le, sizeof(le), "+Inf");
+			
+			len = append(buf, size, len, "rgbdsend_stage_ms_bucket{stage=\"%s\",le=\"%s\"} %lld\n", stage_names[s], le, cumulative);
+		}
+		
+		len = append(buf, size, len, "rgbdsend_stage_ms_sum{stage=\"%s\"} %.3f\n", stage_names[s], h.sum_us/1000.0);
+		len = append(buf, size, len, "rgbdsend_stage_ms_count{stage=\"%s\"} %lld\n", stage_names[s], (long long)h.count);
+	}
+	
+	for(int c = 0; c < STAT_COUNTER_COUNT; c++) {
+		len = append(buf, size, len, "# TYPE rgbdsend_%s_total counter\n", counter_names[c]);
+		len = append(buf, size, len, "rgbdsend_%s_total %lld\n", counter_names[c], (long long)counters[c]);
+	}
+	
+	return len;
+}
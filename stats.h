@@ -0,0 +1,40 @@
+#ifndef STATS_H
+#define STATS_H
+
+#include <ctime>
+
+// Process wide latency histograms and counters. Recording is a few atomic
+// adds, so it can be done from any thread.
+
+enum StatStage {
+	STAGE_CAPTURE, // recording the sensor, direct or to an ONI
+	STAGE_REPLAY, // reading an ONI back
+	STAGE_CLOUD, // depth_to_pointcloud
+	STAGE_EXPORT, // writing a cloud to disk
+	STAGE_UPLOAD, // one upload attempt
+	STAGE_THUMBNAIL,
+	STAGE_COUNT
+};
+
+enum StatCounter {
+	STAT_CAPTURES,
+	STAT_FRAMES_ACCEPTED, // depth and color frames that went into a capture
+	STAT_FRAMES_REJECTED, // frames read that didn't fit the capture's resolution
+	STAT_READ_TIMEOUTS, // waits for a live frame that timed out
+	STAT_SAMPLES_ACCEPTED, // depth pixels that went into an average
+	STAT_SAMPLES_REJECTED, // invalid or outlying depth pixels
+	STAT_POINTS,
+	STAT_UPLOADS,
+	STAT_UPLOADS_FAILED, // attempts, including the ones retried
+	STAT_BYTES_UPLOADED,
+	STAT_COUNTER_COUNT
+};
+
+// records the time since start for stage.
+void stats_time(int stage, struct timespec &start);
+void stats_add(int counter, long long value);
+// prints all stats in the Prometheus text format. returns the length, which
+// may be more than size if buf is too small.
+int stats_format(char *buf, int size);
+
+#endif
@@ -0,0 +1,78 @@
+#include <cmath>
+
+#include "synthetic.h"
+
+SyntheticScene::SyntheticScene(int width, int height, float noise, float invalid, uint32_t seed) {
+	this->width = width;
+	this->height = height;
+	this->hfov = 1.0225f; // the field of view of the usual structured light sensors
+	this->vfov = 0.7959f;
+	this->noise = noise;
+	this->state = seed != 0 ? seed : 1;
+	
+	// in double, as 1 times 2^32-1 rounds to 2^32 in float. NaN counts as 0.
+	double threshold = invalid > 0.f ? invalid*4294967296.0 : 0.0;
+	this->invalid = threshold < 4294967295.0 ? (uint32_t)threshold : 0xffffffffu;
+	
+	base = new float[width*height];
+	
+	float cx = width/2.f, cy = height/2.f;
+	float r = height/4.f;
+	
+	for(int y = 0; y < height; y++) {
+		for(int x = 0; x < width; x++) {
+			// the wall gets further away to the top right.
+			float z = 2000.f+800.f*(x/(float)width)-600.f*(y/(float)height);
+			
+			float dx = (x-cx)/r, dy = (y-cy)/r;
+			float d2 = dx*dx+dy*dy;
+			if(d2 < 1.f)
+				z = 1200.f-400.f*sqrtf(1.f-d2);
+			
+			base[x+y*width] = z;
+		}
+	}
+}
+
+SyntheticScene::~SyntheticScene() {
+	delete[] base;
+}
+
+// xorshift32. rand() would serialize threads on its lock.
+uint32_t SyntheticScene::random(void) {
+	state ^= state << 13;
+	state ^= state >> 17;
+	state ^= state << 5;
+	return state;
+}
+
+void SyntheticScene::depth(uint16_t *pix) {
+	// the sum of four uniform values is close enough to a gaussian.
+	float scale = noise*sqrtf(3.f)/2147483648.f;
+	
+	for(int i = 0; i < width*height; i++) {
+		if(invalid != 0 && random() < invalid) {
+			pix[i] = 0;
+			continue;
+		}
+		
+		float n = ((float)random()+random()+random()+random()-4294967295.f*2.f)*scale/2.f;
+		float z = base[i]+n;
+		
+		pix[i] = z < 1.f ? 1 : z > 65535.f ? 65535 : (uint16_t)(z+.5f);
+	}
+}
+
+void SyntheticScene::color(uint8_t *rgb) {
+	for(int y = 0; y < height; y++) {
+		for(int x = 0; x < width; x++) {
+			int i = x+y*width;
+			bool check = ((x/16)+(y/16))%2;
+			uint8_t shade = base[i] < 1600.f ? 255-(uint8_t)(base[i]/8.f) : 128;
+			
+			rgb[3*i] = check ? 200 : shade;
+			rgb[3*i+1] = x*255/width;
+			rgb[3*i+2] = y*255/height;
+		}
+	}
+}
@@ -0,0 +1,37 @@
+#ifndef SYNTHETIC_H
+#define SYNTHETIC_H
+
+#include <stdint.h>
+
+// Generates depth and color frames of a fixed scene without a sensor: a
+// sphere in front of a tilted wall. Every depth frame gets fresh gaussian
+// noise and a fresh set of invalid (zero) pixels, like a real sensor.
+class SyntheticScene {
+public:
+	// noise is the standard deviation in millimetres, invalid the share of
+	// pixels without depth (0-1).
+	SyntheticScene(int width, int height, float noise, float invalid, uint32_t seed);
+	~SyntheticScene();
+	
+	// depth in millimetres, width*height pixels.
+	void depth(uint16_t *pix);
+	// packed rgb, width*height pixels.
+	void color(uint8_t *rgb);
+	
+	int width;
+	int height;
+	// field of view the scene is generated for, in radians.
+	float hfov;
+	float vfov;
+	
+private:
+	uint32_t random(void);
+	
+	float noise;
+	uint32_t invalid; // threshold for random()
+	uint32_t state;
+	
+	float *base; // noise free depth
+};
+
+#endif
@@ -0,0 +1,188 @@
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <jpeglib.h>
+
+#include "thumbnail.h"
+#include "rgbdsend.h"
+#include "framesource.h"
+
+Thumbnailer::Thumbnailer() {
+	cinfo = new jpeg_compress_struct;
+	jerr = new jpeg_error_mgr;
+	
+	cinfo->err = jpeg_std_error(jerr);
+	jpeg_create_compress(cinfo);
+	
+	scale = 1;
+	quality = 20;
+	cachetime = 0;
+	
+	scaled = NULL;
+	scaledsize = 0;
+	
+	jpegcapacity = 1 << 16;
+	jpegbuf = (unsigned char *)malloc(jpegcapacity);
+	jpegsize = 0;
+	
+	live = false;
+	cached = false;
+}
+
+Thumbnailer::~Thumbnailer() {
+	jpeg_destroy_compress(cinfo);
+	delete cinfo;
+	delete jerr;
+	
+	delete[] scaled;
+	free(jpegbuf);
+}
+
+void Thumbnailer::setup(int scale, int quality, int cachetime) {
+	if(scale != 2 && scale != 4)
+		scale = 1;
+	
+	this->scale = scale;
+	this->quality = quality;
+	this->cachetime = cachetime;
+	cached = false;
+}
+
+static long ms_since(struct timespec &t) {
+	struct timespec tp;
+	clock_gettime(CLOCK_MONOTONIC, &tp);
+	return (tp.tv_sec-t.tv_sec)*1000+(tp.tv_nsec-t.tv_nsec)/1000000;
+}
+
+// box filter downscaling of a packed rgb image
+static void downscale(const unsigned char *src, int w, int h, unsigned char *dst, int scale) {
+	int dw = w/scale, dh = h/scale;
+	int n = scale*scale;
+	
+	for(int y = 0; y < dh; y++) {
+		for(int x = 0; x < dw; x++) {
+			int sum[3] = {0, 0, 0};
+			
+			for(int sy = 0; sy < scale; sy++) {
+				const unsigned char *p = src+3*((y*scale+sy)*w+x*scale);
+				for(int sx = 0; sx < scale; sx++) {
+					sum[0] += *p++;
+					sum[1] += *p++;
+					sum[2] += *p++;
+				}
+			}
+			
+			for(int k = 0; k < 3; k++)
+				*dst++ = (sum[k]+n/2)/n;
+		}
+	}
+}
+
+int Thumbnailer::encode(const unsigned char *rgb, int width, int height) {
+	if(scale > 1) {
+		int size = 3*(width/scale)*(height/scale);
+		if(size > scaledsize) {
+			delete[] scaled;
+			scaled = new unsigned char[size];
+			scaledsize = size;
+		}
+		
+		downscale(rgb, width, height, scaled, scale);
+		rgb = scaled;
+		width /= scale;
+		height /= scale;
+	}
+	
+	unsigned char *buf = jpegbuf;
+	unsigned long size = jpegcapacity;
+	jpeg_mem_dest(cinfo, &buf, &size);
+	
+	cinfo->image_width = width;
+	cinfo->image_height = height;
+	cinfo->input_components = 3;
+	cinfo->in_color_space = JCS_RGB;
+	
+	jpeg_set_defaults(cinfo);
+	jpeg_set_quality(cinfo, quality, true);
+	jpeg_start_compress(cinfo, true);
+	
+	while(cinfo->next_scanline < cinfo->image_height) {
+		JSAMPROW rowpointer = (JSAMPROW) &rgb[3*cinfo->next_scanline*cinfo->image_width];
+		jpeg_write_scanlines(cinfo, &rowpointer, 1);
+	}
+	
+	jpeg_finish_compress(cinfo);
+	
+	// libjpeg allocates a bigger buffer if ours was too small. keep it for
+	// the next thumbnail.
+	if(buf != jpegbuf) {
+		free(jpegbuf);
+		jpegbuf = buf;
+		jpegcapacity = size;
+	}
+	jpegsize = size;
+	
+	return 1;
+}
+
+int Thumbnailer::get(FrameSource &source, const unsigned char **jpeg, unsigned long *size) {
+	if(cached && ms_since(stamp) < cachetime) {
+		*jpeg = jpegbuf;
+		*size = jpegsize;
+		return 1;
+	}
+	
+	Frame frame;
+
+	if(!live)
+		source.start(SOURCE_COLOR);
+	
+	if(!source.read(&frame, SOURCE_COLOR, rgbdsend::read_wait_timeout)) {
+		printf("\nRecording thumbnail timed out.\n");
+		if(!live)
+			source.stop(SOURCE_COLOR);
+		return 0;
+	}
+	
+	encode((const unsigned char *)frame.data, frame.width, frame.height);
+	if(!live)
+		source.stop(SOURCE_COLOR);
+	
+	clock_gettime(CLOCK_MONOTONIC, &stamp);
+	cached = true;
+	
+	*jpeg = jpegbuf;
+	*size = jpegsize;
+	return 1;
+}
+
+void Thumbnailer::startLive(FrameSource &source) {
+	source.start(SOURCE_COLOR);
+	live = true;
+}
+
+void Thumbnailer::stopLive(FrameSource &source) {
+	if(live)
+		source.stop(SOURCE_COLOR);
+	live = false;
+}
+
+bool Thumbnailer::isLive(void) {
+	return live;
+}
+
+int Thumbnailer::getLive(FrameSource &source, const unsigned char **jpeg, unsigned long *size) {
+	Frame frame;
+	
+	if(!source.read(&frame, SOURCE_COLOR, 0))
+		return 0;
+	
+	encode((const unsigned char *)frame.data, frame.width, frame.height);
+	
+	clock_gettime(CLOCK_MONOTONIC, &stamp);
+	cached = true;
+	
+	*jpeg = jpegbuf;
+	*size = jpegsize;
+	return 1;
+}
@@ -0,0 +1,56 @@
+#ifndef THUMBNAIL_H
+#define THUMBNAIL_H
+
+#include <ctime>
+
+class FrameSource;
+
+struct jpeg_compress_struct;
+struct jpeg_error_mgr;
+
+// Captures JPEG thumbnails from the color stream of a frame source. The compressor and all
+// buffers are kept between thumbnails, and the last thumbnail is served
+// again if it is younger than the cache time.
+class Thumbnailer {
+public:
+	Thumbnailer();
+	~Thumbnailer();
+	
+	// scale: 1, 2 or 4 times downscaling. cachetime in milliseconds.
+	void setup(int scale, int quality, int cachetime);
+	
+	// returns 0 on failure. *jpeg stays valid until the next call.
+	int get(FrameSource &source, const unsigned char **jpeg, unsigned long *size);
+	
+	// keeps the color stream running for a continuous preview.
+	void startLive(FrameSource &source);
+	void stopLive(FrameSource &source);
+	bool isLive(void);
+	// encodes the newest frame of the running stream. returns 0 if there is
+	// no new frame yet.
+	int getLive(FrameSource &source, const unsigned char **jpeg, unsigned long *size);
+	
+	// encodes a packed rgb image
+	int encode(const unsigned char *rgb, int width, int height);
+	
+private:
+	jpeg_compress_struct *cinfo;
+	jpeg_error_mgr *jerr;
+	
+	int scale;
+	int quality;
+	int cachetime;
+	
+	unsigned char *scaled;
+	int scaledsize;
+	
+	unsigned char *jpegbuf; // malloc'd, libjpeg may replace it
+	unsigned long jpegsize;
+	unsigned long jpegcapacity;
+	
+	bool live;
+	bool cached;
+	struct timespec stamp;
+};
+
+#endif
@@ -0,0 +1,38 @@
+#include <cstdio>
+#include <cstring>
+#include <cerrno>
+
+#include "../cloud.h"
+#include "../config.h"
+
+// Converts a compressed .rgbc cloud to PLY.
+// usage: rgbc2ply input.rgbc output.ply [ascii|binary]
+
+int main(int argc, char **argv) {
+	if(argc < 3) {
+		printf("usage: %s input.rgbc output.ply [ascii|binary]\n", argv[0]);
+		return 1;
+	}
+	
+	int format = CLOUD_FORMAT_PLY_BINARY;
+	if(argc > 3 && strcmp(argv[3], "ascii") == 0)
+		format = CLOUD_FORMAT_PLY_ASCII;
+	
+	FILE *f = fopen(argv[1], "rb");
+	if(f == NULL) {
+		printf("Error: Couldn't open '%s': %s.\n", argv[1], strerror(errno));
+		return 1;
+	}
+	
+	PointCloud *cloud = decode_cloud(f);
+	fclose(f);
+	
+	if(cloud == NULL)
+		return 1;
+	
+	export_cloud(argv[2], *cloud, format);
+	printf("Decoded %d points to '%s'\n", cloud->num, argv[2]);
+	
+	delete cloud;
+	return 0;
+}
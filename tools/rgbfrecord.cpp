@@ -0,0 +1,72 @@
+#include <cstdio>
+#include <cstdlib>
+#include <ctime>
+
+#include "../framesource.h"
+#include "../capture.h"
+#include "../config.h"
+#include "../rgbdsend.h"
+
+// Records the frames of the configured source (usually a sensor) to a file
+// the file source can replay.
+// usage: rgbfrecord output.rgbf seconds [config]
+
+int main(int argc, char **argv) {
+	if(argc < 3) {
+		printf("usage: %s output.rgbf seconds [config]\n", argv[0]);
+		return 1;
+	}
+	
+	Config conf;
+	if(argc > 3 && conf.read(argv[3]) != 1) {
+		printf("Config: Falling back to builtin presets.\n");
+		conf.setDefaults();
+	}
+	
+	FrameSource *source = open_frame_source(conf);
+	if(source == NULL)
+		return 1;
+	
+	StreamInfo depth = source->info(SOURCE_DEPTH);
+	StreamInfo color = source->info(SOURCE_COLOR);
+	
+	FrameWriter writer;
+	if(!writer.open(argv[1], depth, color)) {
+		delete source;
+		return 1;
+	}
+	
+	long ms = atof(argv[2])*1000;
+	int frames[2] = {0, 0};
+	struct timespec start, tp;
+	Frame frame;
+	bool ok = true;
+	
+	source->start(SOURCE_DEPTH | SOURCE_COLOR);
+	clock_gettime(CLOCK_MONOTONIC, &start);
+	
+	do {
+		if(!source->read(&frame, SOURCE_DEPTH | SOURCE_COLOR, rgbdsend::read_wait_timeout)) {
+			printf("Error: Timed out waiting for frames.\n");
+			break;
+		}
+		
+		if(!writer.write(frame)) {
+			printf("Error: Couldn't write '%s'.\n", argv[1]);
+			ok = false;
+			break;
+		}
+		
+		frames[frame.stream == SOURCE_DEPTH ? 0 : 1]++;
+		clock_gettime(CLOCK_MONOTONIC, &tp);
+	} while((tp.tv_sec-start.tv_sec)*1000+(tp.tv_nsec-start.tv_nsec)/1000000 < ms);
+	
+	source->stop(SOURCE_DEPTH | SOURCE_COLOR);
+	writer.close();
+	delete source;
+	cleanup_openni();
+	
+	printf("Recorded %d depth and %d color frames to '%s'\n", frames[0], frames[1], argv[1]);
+	
+	return ok ? 0 : 1;
+}